@@ -1,2 +1,3 @@
 module c.eldidi.org/c
 version c11
+os linux -D_POSIX_C_SOURCE=200809L -D_DEFAULT_SOURCE
@@ -1,21 +1,34 @@
 #!/usr/bin/env python3
+import hashlib
+import http.client
 import itertools
+import json
+import mmap
+import urllib.error
 import urllib.request
 import copy
 import os
 import sys
 import pathlib
 import argparse
+import concurrent.futures
+import contextlib
+import ctypes
 import subprocess
 import shutil
 import platform
+import select
+import struct
+import threading
+import time
 from dataclasses import dataclass, field
-from typing import Literal, Optional
+from typing import Optional
 
 # A python implementation of the `cbuild` command. Used for bootstrapping this
-# repository, but also kept up to date with the C implementation.
+# repository, but also kept up to date with the C implementation in
+# cbuild/cbuild.c. Both produce the same build directory, so either can pick up
+# where the other left off.
 
-# TODO: make the C implementation.
 # TODO: when a dependency specifies a platform flag, build everything with that
 #       flag.
 
@@ -24,16 +37,44 @@ C_CACHE_DIR: pathlib.Path = (
     pathlib.Path(os.environ.get("XDG_CACHE_HOME", DEFAULT_CACHE_DIR)) / "c"
 )
 C_CLANG_COMMAND: pathlib.Path = os.environ.get("CLANG_COMMAND", "clang")
+# The archiver library objects are packed with. Picked to match the compiler
+# when unset; see archiver().
+C_AR_COMMAND: Optional[str] = os.environ.get("AR_COMMAND")
+# Compile steps run in the build directory, so relative paths to the tools
+# have to be made absolute.
+if "/" in C_CLANG_COMMAND:
+    C_CLANG_COMMAND = os.path.abspath(C_CLANG_COMMAND)
+if C_AR_COMMAND is not None and "/" in C_AR_COMMAND:
+    C_AR_COMMAND = os.path.abspath(C_AR_COMMAND)
+# What's prepended to an import path to get the URL of its repository. Tests
+# point this at a directory of local repositories using a file:// URL.
+C_REMOTE_URL = os.environ.get("C_REMOTE_URL", "https://")
+# Where compile outputs are shared with other checkouts and machines, on top of
+# the local cache: a directory, or the URL of an HTTP server. See
+# cache_backend.
+C_REMOTE_CACHE: Optional[str] = os.environ.get("C_REMOTE_CACHE")
 C_BUILD_CACHE_DIR = C_CACHE_DIR / "build"
 C_DOWNLOAD_DIR = C_CACHE_DIR / "pkg"
-if C_BUILD_CACHE_DIR.exists():
-    shutil.rmtree(C_BUILD_CACHE_DIR)
+# Compile outputs, stored by the hash of everything that went into producing
+# them. Import paths always start with a domain name, so a dot-prefixed name
+# can't collide with a module's build directory.
+C_OBJECT_CACHE_DIR = C_BUILD_CACHE_DIR / ".objects"
 C_CACHE_DIR.mkdir(parents=True, exist_ok=True)
 C_DOWNLOAD_DIR.mkdir(parents=True, exist_ok=True)
 C_BUILD_CACHE_DIR.mkdir(parents=True, exist_ok=True)
+C_OBJECT_CACHE_DIR.mkdir(parents=True, exist_ok=True)
+# Bump this whenever the layout of the object cache or the way keys are
+# computed changes, so old entries are never mistaken for new ones.
+CACHE_VERSION = "4"
 # A in-memory cache of the module objects we've created, indexed by
 # import_path.
 MOD_CACHE = {}
+# The modules of each project the index describes, by the project's directory,
+# until Module.from_directory takes them. See load_index.
+INDEXED: dict[pathlib.Path, list["Module"]] = {}
+# The import paths of the modules whose __module.h was already regenerated
+# during this build.
+GENERATED_HEADERS = set()
 args: argparse.Namespace
 
 
@@ -45,6 +86,95 @@ def get_os() -> str:
     return result
 
 
+@dataclass
+class CacheStats:
+    """Counts object cache lookups so `--stats` can report them."""
+
+    hits: int = 0
+    misses: int = 0
+    # How many of the hits were fetched from the remote cache.
+    remote_hits: int = 0
+    lock: threading.Lock = field(default_factory=threading.Lock)
+
+    def record(self, hit: bool, remote: bool = False):
+        with self.lock:
+            if hit:
+                self.hits += 1
+                self.remote_hits += remote
+            else:
+                self.misses += 1
+
+
+STATS = CacheStats()
+
+
+class Tracer:
+    """Tracer records how long each phase of the build took for each module,
+    in the Chrome trace event format, so `--trace` can write a file which can
+    be loaded into chrome://tracing or Perfetto. Every thread gets its own
+    track."""
+
+    def __init__(self):
+        self.enabled = False
+        self.lock = threading.Lock()
+        self.start = time.perf_counter_ns()
+        self.events: list[dict] = []
+        # Small ids for each thread seen so far, indexed by thread ident.
+        self.tids: dict[int, int] = {}
+
+    def _tid(self) -> int:
+        ident = threading.get_ident()
+        tid = self.tids.get(ident)
+        if tid is None:
+            tid = len(self.tids)
+            self.tids[ident] = tid
+            self.events.append(
+                {
+                    "name": "thread_name",
+                    "ph": "M",
+                    "pid": os.getpid(),
+                    "tid": tid,
+                    "args": {"name": threading.current_thread().name},
+                }
+            )
+        return tid
+
+    @contextlib.contextmanager
+    def span(self, phase: str, subject: str, **span_args):
+        """Records the time taken by the body of the with statement as the
+        given phase of building subject. The yielded dict can be filled in
+        with more args, such as whether the cache was hit."""
+        if not self.enabled:
+            yield span_args
+            return
+
+        begin = time.perf_counter_ns()
+        try:
+            yield span_args
+        finally:
+            end = time.perf_counter_ns()
+            with self.lock:
+                self.events.append(
+                    {
+                        "name": f"{phase} {subject}",
+                        "cat": phase,
+                        "ph": "X",
+                        "ts": (begin - self.start) / 1000,
+                        "dur": (end - begin) / 1000,
+                        "pid": os.getpid(),
+                        "tid": self._tid(),
+                        "args": span_args,
+                    }
+                )
+
+    def save(self, path: pathlib.Path):
+        with self.lock:
+            path.write_text(json.dumps({"traceEvents": self.events}, default=str))
+
+
+TRACE = Tracer()
+
+
 def todo(thing: str):
     print(f"not implemented: {thing}")
     exit(1)
@@ -55,6 +185,468 @@ def error(msg: str):
     exit(1)
 
 
+@dataclass
+class LockEntry:
+    """Where a remote import was resolved to."""
+
+    # The import path of the repository's root module.
+    root: str
+    # The URL the repository was fetched from.
+    url: str
+    # The commit which was checked out.
+    commit: str
+
+
+class Lockfile:
+    """Lockfile is the c.sum file next to a project's c.mod, which pins every
+    remote import to the repository and commit it was resolved to. Each line
+    has the form
+
+        <import path> <root import path> <repository URL> <commit>
+    """
+
+    def __init__(self, path: Optional[pathlib.Path] = None):
+        self.path = path
+        self.entries: dict[str, LockEntry] = {}
+        # The import paths looked up during this build. Anything else is
+        # no longer imported and is dropped when the lockfile is saved.
+        self.used: set[str] = set()
+        if path is None or not path.exists():
+            return
+
+        lines = path.read_text(encoding="utf-8").splitlines()
+        for i in range(len(lines)):
+            line = lines[i].split()
+            if len(line) == 0:
+                continue
+            if len(line) != 4:
+                error(f"{path}:{i + 1}: syntax error")
+            self.entries[line[0]] = LockEntry(
+                root=line[1], url=line[2], commit=line[3]
+            )
+
+    def get(self, import_path: str) -> Optional[LockEntry]:
+        self.used.add(import_path)
+        return self.entries.get(import_path)
+
+    def set(self, import_path: str, entry: LockEntry):
+        self.used.add(import_path)
+        self.entries[import_path] = entry
+
+    def save(self):
+        """Writes the lockfile if anything in it changed."""
+        if self.path is None:
+            return
+
+        entries = {k: v for k, v in self.entries.items() if k in self.used}
+        text = ""
+        for import_path in sorted(entries):
+            entry = entries[import_path]
+            text += f"{import_path} {entry.root} {entry.url} {entry.commit}\n"
+
+        if self.path.exists() and self.path.read_text(encoding="utf-8") == text:
+            return
+        if not self.path.exists() and text == "":
+            return
+        self.path.write_text(text, encoding="utf-8")
+
+
+# The lockfile of the project being built. Replaced by main() once it knows
+# where the project is.
+LOCKFILE = Lockfile()
+
+
+def git(dir: pathlib.Path, *git_argv) -> subprocess.CompletedProcess[bytes]:
+    """Runs git in the given directory."""
+    argv = ["git", "-C", str(dir.resolve())]
+    argv.extend(git_argv)
+    if args.verbose:
+        print(" ".join(map(str, argv)))
+    return subprocess.run(argv, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+
+
+def git_head(dir: pathlib.Path) -> Optional[str]:
+    """Returns the commit checked out in the repository at dir, or None if
+    there isn't one. Reads .git directly so no process has to be started."""
+    gitdir = dir / ".git"
+    try:
+        head = (gitdir / "HEAD").read_text().strip()
+        if not head.startswith("ref: "):
+            return head
+
+        ref = head.removeprefix("ref: ")
+        if (gitdir / ref).exists():
+            return (gitdir / ref).read_text().strip()
+        for line in (gitdir / "packed-refs").read_text().splitlines():
+            line = line.split()
+            if len(line) == 2 and line[1] == ref:
+                return line[0]
+    except OSError:
+        pass
+
+    return None
+
+
+def downloaded_root(import_path: str) -> Optional[str]:
+    """Returns the import path of the downloaded repository containing
+    import_path, if it was downloaded."""
+    if not (C_DOWNLOAD_DIR / import_path).exists():
+        return None
+
+    root = import_path
+    while not (C_DOWNLOAD_DIR / root / "c.mod").exists():
+        if "/" not in root:
+            return None
+        root = root.rsplit("/", maxsplit=1)[0]
+
+    return root
+
+
+def parse_import(line: str) -> Optional[str]:
+    """Returns the import path if line is an #include which imports a module,
+    and None otherwise."""
+    line = line.strip().split()
+    if len(line) < 2:
+        return None
+
+    if line[0] != "#include":
+        return None
+
+    # is it a system include?
+    if line[1].startswith("<"):
+        return None
+
+    include = line[1].strip('"')
+    if include.startswith("./") or include.startswith("../"):
+        return None
+
+    # TODO: I don't know if this is necessary
+    # if include.startswith(str(C_CACHE_DIR.resolve())):
+    #     continue
+
+    return include
+
+
+# How long, in seconds, a probe which found nothing is remembered for. Probes
+# which found a repository are remembered until the cache is deleted.
+NEGATIVE_PROBE_TTL = 60 * 60
+
+
+class ProbeCache:
+    """ProbeCache remembers the result of probing each URL for a repository,
+    including the URLs where nothing was found, so each is probed at most once
+    no matter how many imports or threads ask for it. Results are kept in
+    C_CACHE_DIR / "probe.json" between builds."""
+
+    def __init__(self, path: pathlib.Path):
+        self.path = path
+        self.lock = threading.Lock()
+        # The URL found by each probe (None if there was nothing there) and
+        # when it was probed.
+        self.results: dict[str, dict] = {}
+        # The probes currently in flight.
+        self.pending: dict[str, concurrent.futures.Future] = {}
+        self.dirty = False
+        try:
+            self.results = json.loads(path.read_text())
+        except (OSError, json.JSONDecodeError):
+            pass
+
+    def probe(self, url: str) -> Optional[str]:
+        """Returns the URL url redirects to if there is something there, and
+        None otherwise."""
+        with TRACE.span("probe", url) as span:
+            span["hit"] = True
+            with self.lock:
+                result = self.results.get(url)
+                if result is not None and (
+                    result["url"] is not None
+                    or time.time() - result["time"] < NEGATIVE_PROBE_TTL
+                ):
+                    return result["url"]
+
+                future = self.pending.get(url)
+                if future is None:
+                    future = concurrent.futures.Future()
+                    self.pending[url] = future
+                    owner = True
+                else:
+                    owner = False
+
+            if not owner:
+                return future.result()
+
+            span["hit"] = False
+            if args.verbose:
+                print(f"probing {url}")
+            found = None
+            if url.startswith("file://"):
+                # A local repository; there's nothing to redirect.
+                if os.path.isdir(url.removeprefix("file://")):
+                    found = url
+            else:
+                try:
+                    with urllib.request.urlopen(url, timeout=1) as resp:
+                        found = resp.url
+                except Exception as _:
+                    pass
+
+            span["found"] = found
+            with self.lock:
+                self.results[url] = {"url": found, "time": time.time()}
+                self.dirty = True
+                del self.pending[url]
+            future.set_result(found)
+            return found
+
+    def save(self):
+        if self.dirty:
+            self.path.write_text(json.dumps(self.results, indent=1))
+
+
+PROBES = ProbeCache(C_CACHE_DIR / "probe.json")
+
+
+def probe_repository(import_path: str) -> tuple[str, str]:
+    """Finds the repository containing import_path, returning the import path
+    of its root and the URL to fetch it from."""
+    currentmod = import_path
+    while True:
+        # Resolve any redirects to get the actual repository name (required
+        # when trying to access github hosted repositories begind a
+        # redirect, which is the case for many of my c.eldidi.org modules).
+        url = PROBES.probe(C_REMOTE_URL + currentmod)
+        if url is None:
+            modsplit = currentmod.rsplit("/", maxsplit=1)
+            # If we've reached first part of the module name and still
+            # haven't found anything, it must not exist.
+            if len(modsplit) == 1:
+                error(f"no module with name {import_path}")
+
+            currentmod = "/".join(modsplit[:-1])
+            continue
+
+        return currentmod, url
+
+
+def remote_imports(path: pathlib.Path, import_path: str) -> dict[str, str]:
+    """Returns the imports of modules outside the project in path, whose
+    import path is import_path, mapped to the module which imports them."""
+    result = {}
+    dirs = [(path, import_path)]
+    for child in sorted(path.glob("*")):
+        if child.is_dir() and not child.name.startswith("."):
+            dirs.append((child, import_path + "/" + child.name))
+
+    for dir, dir_import_path in dirs:
+        for file in itertools.chain(dir.glob("*.c"), dir.glob("*.h")):
+            if file.is_dir():
+                continue
+            for line in file.read_text(encoding="utf-8").splitlines():
+                include = parse_import(line)
+                if include is None or include.startswith(import_path):
+                    continue
+                result.setdefault(include, dir_import_path)
+
+    return result
+
+
+def prefetch(project: pathlib.Path, import_path: str):
+    """Downloads every remote module the project at path needs, directly or
+    not, before anything is preprocessed.
+
+    This is done in waves: first every remote import in the project is
+    located, either from the lockfile or by probing, then every repository
+    which isn't downloaded yet is fetched, up to args.fetch_jobs at once. The
+    repositories found are then scanned for the next wave of imports. A
+    repository is fetched at most once no matter how many of its modules are
+    imported.
+    """
+    pending = remote_imports(project, import_path)
+    seen = set()
+    # The roots of the repositories found so far.
+    roots = set()
+
+    def locate(include: str) -> tuple[Optional[LockEntry], bool]:
+        """Returns where include comes from and whether it still has to be
+        fetched. The entry is None if it comes from a repository downloaded
+        by a previous build which isn't in the lockfile, which
+        resolve_import records later."""
+        entry = LOCKFILE.get(include)
+        if entry is not None:
+            return entry, git_head(C_DOWNLOAD_DIR / entry.root) != entry.commit
+
+        if downloaded_root(include) is not None:
+            return None, False
+
+        root, url = probe_repository(include)
+        return LockEntry(root, url, ""), True
+
+    with concurrent.futures.ThreadPoolExecutor(
+        max_workers=args.fetch_jobs, thread_name_prefix="fetch"
+    ) as pool:
+        while len(pending) != 0:
+            wave = {k: v for k, v in pending.items() if k not in seen}
+            seen |= set(wave)
+
+            # Discovery pass: find the repository for each import. Imports
+            # from a repository we've already found don't need probing.
+            located = {}
+            for include in wave:
+                known = [r for r in roots if include.startswith(r + "/")]
+                if include in roots or len(known) != 0:
+                    continue
+                located[include] = pool.submit(locate, include)
+
+            # Fetch pass: download every repository which is missing, once.
+            fetches = {}
+            found = {}
+            for include, future in located.items():
+                entry, needed = future.result()
+                if entry is None:
+                    entry = LockEntry(downloaded_root(include), "", "")
+                found[include] = entry
+                roots.add(entry.root)
+                if needed and entry.root not in fetches:
+                    print(f"downloading module {include}...")
+                    fetches[entry.root] = pool.submit(
+                        fetch_repository, entry, wave[include]
+                    )
+
+            for root, future in fetches.items():
+                commit = future.result()
+                for include, entry in found.items():
+                    if entry.root == root and entry.commit == "":
+                        LOCKFILE.set(include, LockEntry(root, entry.url, commit))
+
+            # The repositories we just found may import more.
+            pending = {}
+            for root in sorted({entry.root for entry in found.values()}):
+                for include, importer in remote_imports(
+                    C_DOWNLOAD_DIR / root, root
+                ).items():
+                    pending.setdefault(include, importer)
+
+
+def fetch_repository(entry: LockEntry, importer: str) -> str:
+    """Downloads the repository described by entry into the download
+    directory, checking out entry.commit if given, or the main branch
+    otherwise. Returns the commit which was checked out."""
+    with TRACE.span("fetch", entry.root, url=entry.url) as span:
+        span["commit"] = _fetch_repository(entry, importer)
+        return span["commit"]
+
+
+def _fetch_repository(entry: LockEntry, importer: str) -> str:
+    moddir = C_DOWNLOAD_DIR / entry.root
+    moddir.mkdir(parents=True, exist_ok=True)
+    if args.verbose:
+        print(str(moddir))
+
+    def fail(ret: subprocess.CompletedProcess[bytes]):
+        print(ret.stderr.decode("utf-8"), file=sys.stderr)
+        error(
+            f"failed to fetch module '{entry.root}' (imported by "
+            + f"'{importer}')"
+        )
+
+    # We do `git init; git remote add url git fetch; git checkout;`
+    # instead of `git clone folder url` in case the folder is not
+    # empty, which git doesn't allow.
+    if not (moddir / ".git").exists():
+        ret = git(moddir, "init")
+        assert ret.returncode == 0
+
+        ret = git(moddir, "remote", "add", "origin", entry.url)
+        assert ret.returncode == 0
+    else:
+        ret = git(moddir, "remote", "set-url", "origin", entry.url)
+        assert ret.returncode == 0
+
+    if entry.commit != "":
+        ret = git(moddir, "fetch", "--depth=1", "origin", entry.commit)
+        if ret.returncode != 0:
+            fail(ret)
+        ret = git(moddir, "checkout", "--detach", entry.commit)
+        if ret.returncode != 0:
+            fail(ret)
+        return entry.commit
+
+    ret = git(moddir, "fetch", "--depth=1")
+    if ret.returncode != 0:
+        fail(ret)
+
+    ret = git(moddir, "checkout", "main")
+    if ret.returncode != 0:
+        fail(ret)
+
+    commit = git_head(moddir)
+    assert commit is not None
+    return commit
+
+
+@dataclass
+class Modfile:
+    """The contents of a c.mod file."""
+
+    import_path: str
+    std: Optional[str]
+    platform_flags: dict[str, list[str]]
+    # The flags each profile declared with the profile directive adds.
+    profiles: dict[str, list[str]]
+
+
+def parse_modfile(cmod_file: pathlib.Path) -> Modfile:
+    import_path = None
+    std = None
+    platform_flags = {}
+    profiles = {}
+    with cmod_file.open(encoding="utf-8") as cmod:
+        for line in cmod.readlines():
+            line = line.split()
+            if len(line) == 0:
+                continue
+            if len(line) < 2:
+                error("c.mod: syntax error")
+            if line[0] == "module":
+                if len(line) != 2:
+                    error("c.mod: syntax error")
+                if import_path is not None:
+                    error("c.mod: only one module directive may be specified")
+                import_path = line[1].strip()
+                continue
+            elif line[0] == "version":
+                if len(line) != 2:
+                    error("c.mod: syntax error")
+                if std is not None:
+                    error("c.mod: only one version directive may be specified")
+                std = line[1].strip()
+                continue
+            elif line[0] == "os":
+                deps = []
+                if get_os() == line[1]:
+                    deps += line[2:]
+
+                platform_flags[line[1]] = deps
+                continue
+            elif line[0] == "profile":
+                # A profile may be declared without any flags of its own.
+                profiles.setdefault(line[1], []).extend(line[2:])
+                continue
+
+            error(f"c.mod: unrecognized directive: {line[0]}")
+
+    if import_path is None:
+        error(f"{cmod_file}: no module directive specified")
+
+    return Modfile(
+        import_path=import_path,
+        std=std,
+        platform_flags=platform_flags,
+        profiles=profiles,
+    )
+
+
 @dataclass
 class Module:
     """Module contains all the information associated with a C source module."""
@@ -69,14 +661,20 @@ class Module:
     # A list of the names of each submodule.
     submodules: list[str]
     platform_flags: dict[str, list[str]]
+    profiles: dict[str, list[str]]
     parent: Optional["Module"] = None
     dependencies: set["Module"] = field(default_factory=set)
 
     def get_submodule(self, name: str) -> Optional["Module"]:
         assert name in self.submodules
+        import_path = self.import_path + "/" + name
+        if import_path in MOD_CACHE:
+            return MOD_CACHE[import_path]
+
         result = copy.copy(self)
         result.parent = self
         result.submodules = []
+        result.dependencies = set()
         result.path /= name
         result.import_path += "/" + name
         result.has_executable = (result.path / "main.c").exists()
@@ -109,34 +707,60 @@ class Module:
     def h(self) -> pathlib.Path:
         """Generates a __module.h file for self."""
         implicit = C_BUILD_CACHE_DIR / self.import_path / "__module.h"
-        if implicit.exists():
+        if self.import_path in GENERATED_HEADERS:
             return implicit.resolve()
 
-        implicit_include = ""
-        for header in (C_BUILD_CACHE_DIR / self.import_path).glob("*.h"):
-            if header == implicit:
-                continue
-            implicit_include += f'#include "{header.resolve()}"\n'
-        implicit_include += "\n"
+        with TRACE.span("module_h", self.import_path) as span:
+            implicit_include = ""
+            for header in sorted((C_BUILD_CACHE_DIR / self.import_path).glob("*.h")):
+                if header == implicit:
+                    continue
+                implicit_include += f'#include "{header.name}"\n'
+            implicit_include += "\n"
 
-        # put file in cache
-        implicit.write_text(implicit_include)
+            # put file in cache, leaving it alone if it didn't change so the
+            # build cache from a previous run stays valid.
+            span["hit"] = (
+                implicit.exists() and implicit.read_text() == implicit_include
+            )
+            if not span["hit"]:
+                implicit.write_text(implicit_include)
+        GENERATED_HEADERS.add(self.import_path)
         return implicit.resolve()
 
     def module_name(self) -> str:
         return self.import_path.split("/")[-1]
 
+    def output_dir(self) -> pathlib.Path:
+        """Returns where the module's build outputs go. Each profile has its
+        own, so switching between them doesn't throw any outputs away."""
+        return C_BUILD_CACHE_DIR / ".profiles" / PROFILE.name / self.import_path
+
     def lib(self) -> Optional[pathlib.Path]:
         if not self.has_lib:
             return None
 
-        return C_BUILD_CACHE_DIR / self.import_path / "lib.o"
+        return self.output_dir() / "lib.o"
+
+    def archive(self) -> Optional[pathlib.Path]:
+        if not self.has_lib:
+            return None
+
+        return self.output_dir() / f"lib{self.module_name()}.a"
 
     def exe(self) -> Optional[pathlib.Path]:
         if not self.has_executable:
             return None
 
-        return C_BUILD_CACHE_DIR / self.import_path / self.module_name()
+        return self.output_dir() / self.module_name()
+
+    def inputs(self) -> Optional[pathlib.Path]:
+        """Returns the manifest of the files the module's executable was
+        built from. See write_inputs."""
+        if not self.has_executable:
+            return None
+
+        return self.output_dir() / f"{self.module_name()}.inputs"
 
     def is_submodule(self) -> bool:
         return self.parent is not None
@@ -162,179 +786,213 @@ class Module:
 
             return root.get_submodule(modname)
 
-        # If it already was fetched, we're done.
-        # NOTE: This is only the case because we're not actually caching
-        #       anything. This only checks if we've already downloaded it
-        #       during the current build, not if it was here from a previous
-        #       build.
-        if (C_DOWNLOAD_DIR / import_path).exists():
-            # if (C_BUILD_CACHE_DIR / import_path).exists():
-            #     todo("make a module from")
-            moddir = C_DOWNLOAD_DIR / import_path
-            if (moddir / "c.mod").exists():
-                if import_path in MOD_CACHE:
-                    return MOD_CACHE[import_path]
-                return Module.from_directory(moddir)
-
-            submod = import_path.split("/")[-1]
-            if import_path in MOD_CACHE:
-                return MOD_CACHE[import_path]
-            return Module.from_directory(moddir.parent).get_submodule(submod)
-
-        # It is a remote module
-        print(f"downloading module {import_path}...")
-
-        # First create the path where it will go
-        (C_DOWNLOAD_DIR / import_path).mkdir(parents=True, exist_ok=True)
-
-        # Convenience function to call git for us
-        def git(*git_argv) -> subprocess.CompletedProcess[bytes]:
-            argv = [
-                "git",
-                "-C",
-                str((C_DOWNLOAD_DIR / currentmod).resolve()),
-            ]
-            argv.extend(git_argv)
-            if args.verbose:
-                print(" ".join(map(str, argv)))
-            return subprocess.run(argv, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
-
         assert import_path[-1] != "/", "sanitize trailing slashes from import paths"
-        currentmod = import_path
-        while True:
-            # Resolve any redirects to get the actual repository name (required
-            # when trying to access github hosted repositories begind a
-            # redirect, which is the case for many of my c.eldidi.org modules).
-            url = "https://" + currentmod
-            try:
-                with urllib.request.urlopen("https://" + currentmod, timeout=1) as resp:
-                    url = resp.url
-            except Exception as _:
-                modsplit = currentmod.rsplit("/", maxsplit=1)
-                # If we've reached first part of the module name and still
-                # haven't found anything, it must not exist.
-                if len(modsplit) == 1:
-                    error(f"no module with name {import_path}")
-
-                currentmod = "/".join(modsplit[:-1])
-                continue
 
-            break
-
-        if args.verbose:
-            print(str(C_DOWNLOAD_DIR / currentmod))
-
-        # TODO: see if this is necessary
-        # We do `git init; git remote add url git fetch; git checkout;`
-        # instead of `git clone folder url` in case the folder is not
-        # empty, which git doesn't allow.
-        ret = git("init")
-        assert ret.returncode == 0
-
-        ret = git("remote", "add", "origin", url)
-        assert ret.returncode == 0
-
-        ret = git("fetch", "--depth=1")
-        if ret.returncode != 0:
-            print(ret.stderr.decode("utf-8"), file=sys.stderr)
-            error(
-                f"failed to fetch module '{import_path}' (imported by "
-                + f"'{self.import_path}')"
-            )
+        # It is a remote module. The lockfile tells us exactly which
+        # repository and commit it comes from, so we only need to go to the
+        # network if that commit isn't downloaded yet.
+        entry = LOCKFILE.get(import_path)
+        if entry is not None:
+            if git_head(C_DOWNLOAD_DIR / entry.root) != entry.commit:
+                print(f"downloading module {import_path}...")
+                fetch_repository(entry, self.import_path)
+            return self._downloaded_module(entry.root, import_path)
+
+        # If it was fetched by a previous build, record it in the lockfile
+        # as-is.
+        root = downloaded_root(import_path)
+        if root is not None:
+            ret = git(C_DOWNLOAD_DIR / root, "remote", "get-url", "origin")
+            commit = git_head(C_DOWNLOAD_DIR / root)
+            if ret.returncode == 0 and commit is not None:
+                url = ret.stdout.decode("utf-8").strip()
+                LOCKFILE.set(import_path, LockEntry(root, url, commit))
+                return self._downloaded_module(root, import_path)
 
-        ret = git("checkout", "main")
-        if ret.returncode != 0:
-            print(ret.stderr.decode("utf-8"), file=sys.stderr)
-            error(
-                f"failed to fetch module '{import_path}' (imported by "
-                + f"'{self.import_path}')"
-            )
+        print(f"downloading module {import_path}...")
+        root, url = probe_repository(import_path)
+        entry = LockEntry(root, url, "")
+        entry.commit = fetch_repository(entry, self.import_path)
+        LOCKFILE.set(import_path, entry)
+        return self._downloaded_module(root, import_path)
+
+    def _downloaded_module(self, root: str, import_path: str) -> "Module":
+        """Returns the module for import_path, which is found in the
+        repository downloaded to C_DOWNLOAD_DIR / root."""
+        if import_path in MOD_CACHE:
+            self.dependencies.add(import_path)
+            return MOD_CACHE[import_path]
 
-        moddir = C_DOWNLOAD_DIR / currentmod
-        cmod = moddir / "c.mod"
-        if not cmod.exists():
+        moddir = C_DOWNLOAD_DIR / root
+        if not (moddir / "c.mod").exists():
             error(
                 "downloaded repository is not a cbuild project (no c.mod "
                 + "file found)"
             )
 
         result = Module.from_directory(moddir)
-        MOD_CACHE[result.import_path] = result
-        for submod in result.submodules:
-            MOD_CACHE[result.import_path + "/" + submod] = result.get_submodule(submod)
-        if currentmod == import_path:
-            self.dependencies.add(result.import_path)
-            # we imported the root module
-            return result
+        if root != import_path:
+            # we imported a submodule
+            submodname = import_path[len(root) + 1 :]
+            if submodname not in result.submodules:
+                error(
+                    f"module '{root}' has no submodule '{submodname}' "
+                    + f"(imported by {self.import_path})"
+                )
+            result = result.get_submodule(submodname)
+
+        self.dependencies.add(result.import_path)
+        return result
 
-        # we imported a submodule
-        submodname = import_path[len(currentmod) + 1 :]
-        if submodname not in result.submodules:
+    def _import(self, include: str) -> str:
+        """Resolves an include found in one of self's files, returning the
+        path of the header it should be replaced with."""
+        imported_mod = self.resolve_import(include)
+        if imported_mod.import_path == self.import_path:
             error(
-                f"module '{currentmod}' has no submodule '{submodname}'"
-                + f"(imported by {self.import_path})"
+                f"module '{self.import_path}' includes itself, "
+                + "which is not allowed."
             )
 
-        result = result.get_submodule(submodname)
-        self.dependencies.add(result.import_path)
-        return result
+        self.dependencies.add(imported_mod.import_path)
+        self.dependencies |= imported_mod.dependencies
+        # Relative to the directory the file ends up in, so it's the same
+        # wherever the build directory is.
+        return os.path.relpath(
+            f"{imported_mod.import_path}/__module.h", self.import_path
+        )
+
+    @staticmethod
+    def _rewrite_file(mod: "Module", file: pathlib.Path, text: str):
+        """Rewrites the imports in the given source file of mod, returning the
+        new contents along with the imports found and what they resolved to."""
+        imports = []
+        resolved = []
+        lines = text.splitlines()
+        for i in range(len(lines)):
+            include = parse_import(lines[i])
+            if include is None:
+                continue
+
+            new_include = mod._import(include)
+            imports.append(include)
+            resolved.append(new_include)
+            lines[i] = f'#include "{new_include}"'
+
+        # if the file is not local to the project, it will be in the cache
+        # directory, and we should refer to it by its module path, not file
+        # path.
+        name = str(pathlib.Path(mod.import_path) / file.relative_to(mod.path))
+        lines.insert(0, f'#line 1 "{name}"')
+        return "\n".join(lines), imports, resolved
 
     @staticmethod
     def _preprocess_dir(mod: "Module"):
+        with TRACE.span("preprocess", mod.import_path, hits=0, misses=0) as span:
+            Module._preprocess_files(mod, span)
+
+    @staticmethod
+    def _preprocess_files(mod: "Module", span: dict):
+        """Preprocesses mod's files, counting the files which could be
+        reused from a previous run in span."""
         if args.verbose:
             print(f"preprocessing module '{mod.import_path}'")
-        # hash_dir = C_CACHE_DIR / "hash"
+        out = C_BUILD_CACHE_DIR / mod.import_path
+        out.mkdir(exist_ok=True, parents=True)
+
+        # The manifest remembers, for every file preprocessed in a previous
+        # run, its metadata, a hash of its contents, the imports in it and
+        # the metadata of the output written for it. A file whose metadata
+        # and resolved imports are unchanged isn't read again, as long as its
+        # output wasn't changed by anything else, like the C implementation,
+        # and an output whose contents wouldn't change isn't rewritten, so
+        # its mtime is left alone.
+        manifest_file = out / ".manifest.json"
+        manifest = {}
+        if manifest_file.exists():
+            try:
+                manifest = json.loads(manifest_file.read_text())
+            except json.JSONDecodeError:
+                manifest = {}
+        old_manifest = copy.deepcopy(manifest)
+
+        def output_stat(output: pathlib.Path) -> Optional[list[int]]:
+            try:
+                stat = output.stat()
+            except FileNotFoundError:
+                return None
+            return [stat.st_mtime_ns, stat.st_size]
+
+        sources = set()
         for file in itertools.chain(mod.path.glob("*.c"), mod.path.glob("*.h")):
             if file.is_dir():
                 continue
             if file.name == "c.mod":
                 continue
-
-            lines = file.read_text(encoding="utf-8").splitlines()
-            for i in range(len(lines)):
-                line = lines[i].strip().split()
-                if len(line) == 0:
-                    continue
-
-                if line[0] != "#include":
-                    continue
-
-                # is it a system include?
-                if line[1].startswith("<"):
-                    continue
-
-                include = line[1].strip('"')
-                if include.startswith("./") or include.startswith("../"):
+            sources.add(file.name)
+
+            output = out / file.name
+            stat = file.stat()
+            entry = manifest.get(file.name)
+            current = output_stat(output)
+            output_unchanged = (
+                entry is not None
+                and current is not None
+                and entry.get("output") == current
+            )
+            if (
+                output_unchanged
+                and entry["mtime_ns"] == stat.st_mtime_ns
+                and entry["size"] == stat.st_size
+            ):
+                resolved = [mod._import(include) for include in entry["imports"]]
+                if resolved == entry["resolved"]:
+                    span["hits"] += 1
                     continue
 
-                # TODO: I don't know if this is necessary
-                # if include.startswith(str(C_CACHE_DIR.resolve())):
-                #     continue
-
-                imported_mod = mod.resolve_import(include)
-                if imported_mod.import_path == mod.import_path:
-                    error(
-                        f"module '{mod.import_path}' includes itself, "
-                        + "which is not allowed."
-                    )
+            span["misses"] += 1
+            data = file.read_bytes()
+            digest = hashlib.sha256(data).hexdigest()
+            text, imports, resolved = Module._rewrite_file(
+                mod, file, data.decode("utf-8")
+            )
+            manifest[file.name] = {
+                "mtime_ns": stat.st_mtime_ns,
+                "size": stat.st_size,
+                "sha256": digest,
+                "imports": imports,
+                "resolved": resolved,
+            }
+            if (
+                output_unchanged
+                and entry["sha256"] == digest
+                and entry["resolved"] == resolved
+            ):
+                # Only the metadata changed (e.g. the file was touched).
+                manifest[file.name]["output"] = entry["output"]
+                continue
 
-                mod.dependencies.add(imported_mod.import_path)
-                mod.dependencies |= imported_mod.dependencies
-                new_include = C_BUILD_CACHE_DIR / imported_mod.import_path
-                lines[i] = f'#include "{(new_include /"__module.h").resolve()}"'
-
-            # if the file is not local to the project, it will be in the cache
-            # directory, and we should refer to it by its module path, not file
-            # path.
-            name = str(pathlib.Path(mod.import_path) / file.relative_to(mod.path))
-            lines.insert(0, f'#line 1 "{name}"')
-            lines = "\n".join(lines)
             # put preprocessed file in cache
-            out = C_BUILD_CACHE_DIR / mod.import_path
-            if args.verbose:
-                print(f"writing include {out / file.name}")
-            out.mkdir(exist_ok=True, parents=True)
-            (out / file.name).write_text(lines)
+            if not (output.exists() and output.read_text(encoding="utf-8") == text):
+                if args.verbose:
+                    print(f"writing include {output}")
+                output.write_text(text, encoding="utf-8")
+            manifest[file.name]["output"] = output_stat(output)
+
+        # The build directory persists between runs, so files which were
+        # deleted from the module must be removed from it too, otherwise
+        # they'd still end up in __module.h.
+        for file in itertools.chain(out.glob("*.c"), out.glob("*.h")):
+            if file.name != "__module.h" and file.name not in sources:
+                if args.verbose:
+                    print(f"removing stale file {file}")
+                file.unlink()
+        for name in list(manifest):
+            if name not in sources:
+                del manifest[name]
+
+        if manifest != old_manifest:
+            manifest_file.write_text(json.dumps(manifest, indent=1))
 
     def _preprocess(self):
         """_preprocess preprocesses self so it can be built."""
@@ -346,6 +1004,9 @@ class Module:
     @staticmethod
     def from_directory(path: pathlib.Path) -> "Module":
         """Returns a module given a directory with a c.mod file."""
+        if path in INDEXED:
+            return Module._from_index(INDEXED.pop(path))
+
         # parse c.mod file
         # result = Module()
         cmod_file = path / "c.mod"
@@ -358,42 +1019,11 @@ class Module:
             + "containing a c.mod file or its subdirectory"
         )
 
-        import_path = None
-        name = ""
-        std = None
-        platform_flags = {}
-        with cmod_file.open(encoding="utf-8") as cmod:
-            for line in cmod.readlines():
-                line = line.split()
-                if len(line) == 0:
-                    continue
-                if len(line) < 2:
-                    error("c.mod: syntax error")
-                if line[0] == "module":
-                    if len(line) != 2:
-                        error("c.mod: syntax error")
-                    if import_path is not None:
-                        error("c.mod: only one module directive may be specified")
-                    import_path = line[1].strip()
-                    name = import_path.split("/")[-1]
-                    continue
-                elif line[0] == "version":
-                    if len(line) != 2:
-                        error("c.mod: syntax error")
-                    if std is not None:
-                        error("c.mod: only one version directive may be specified")
-                    std = line[1].strip()
-                    continue
-                elif line[0] == "os":
-                    deps = []
-                    os = get_os()
-                    if os == line[1]:
-                        deps += line[2:]
-
-                    platform_flags[line[1]] = deps
-                    continue
-
-                error(f"c.mod: unrecognized directive: {line[0]}")
+        modfile = parse_modfile(cmod_file)
+        import_path = modfile.import_path
+        name = import_path.split("/")[-1]
+        std = modfile.std
+        platform_flags = modfile.platform_flags
 
         if import_path in MOD_CACHE:
             return MOD_CACHE[import_path]
@@ -436,6 +1066,7 @@ class Module:
             import_path=import_path,
             submodules=submodules,
             platform_flags=platform_flags,
+            profiles=modfile.profiles,
         )
 
         result._preprocess()
@@ -444,82 +1075,1642 @@ class Module:
             MOD_CACHE[result.import_path + "/" + submod] = result.get_submodule(submod)
         return result
 
+    @staticmethod
+    def _from_index(mods: list["Module"]) -> "Module":
+        """Returns the root of the project made of the given modules from the
+        index, preprocessing each one after the modules it depends on."""
+        for mod in mods:
+            MOD_CACHE[mod.import_path] = mod
+        for mod in mods:
+            Module._preprocess_dir(mod)
+        return next(mod for mod in mods if mod.parent is None)
+
+
+_COMPILER_IDENTITY: Optional[str] = None
+
+
+def fnv1a(s: str) -> int:
+    """Returns the 64-bit FNV-1a hash of s, like fnv_1a_str in the x/hash
+    module."""
+    h = 0xCBF29CE484222325
+    for byte in s.encode("utf-8"):
+        h = ((h ^ byte) * 0x100000001B3) & 0xFFFFFFFFFFFFFFFF
+    return h
+
+
+def file_identity(path: str) -> str:
+    """Returns a string that changes whenever the file at path is replaced or
+    modified."""
+    st = os.stat(path)
+    ns = st.st_mtime_ns
+    return f"{st.st_ino} {ns // 10**9}.{ns % 10**9:09d}"
+
+
+def compiler_identity() -> str:
+    """Returns a string identifying the compiler in use, so switching or
+    upgrading compilers never reuses outputs from the old one.
+
+    Asking the compiler takes a few process spawns, so what it says is cached
+    in C_CACHE_DIR/toolchain, in the same files toolchain_find in the util
+    module uses, for as long as PATH still leads to the same compiler binary
+    and it stays the same."""
+    global _COMPILER_IDENTITY
+    if _COMPILER_IDENTITY is not None:
+        return _COMPILER_IDENTITY
+
+    key = os.environ.get("PATH", "") + "\n" + C_CLANG_COMMAND
+    cache_file = C_CACHE_DIR / "toolchain" / f"{fnv1a(key):016x}"
+    fields = {}
+    with contextlib.suppress(OSError):
+        for line in cache_file.read_text("utf-8").splitlines():
+            name, _, value = line.partition(" ")
+            fields[name] = value
+    # Looking the compiler up again is only a stat per directory in PATH, and
+    # catches one installed in front of the cached one.
+    if "/" in C_CLANG_COMMAND:
+        path = os.path.realpath(C_CLANG_COMMAND)
+    else:
+        path = shutil.which(C_CLANG_COMMAND)
+    if path is None or not os.path.isfile(path):
+        error(f"compiler '{C_CLANG_COMMAND}' not found")
+    path = os.path.realpath(path)
+
+    names = ["path", "version", "target", "resource-dir"]
+    valid = (
+        fields.get("key") == key.replace("\n", " ")
+        and all(name in fields for name in names)
+        and fields["path"] == path
+    )
+    with contextlib.suppress(OSError):
+        valid = valid and fields["identity"] == file_identity(path)
+
+    if not valid:
+        def first_line(flag: str) -> str:
+            out = subprocess.run(
+                [path, flag], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL
+            )
+            lines = out.stdout.decode("utf-8").splitlines()
+            return lines[0] if out.returncode == 0 and lines else ""
+
+        # Both clang and gcc keep their own headers in an include directory
+        # next to their runtime libraries.
+        resource_dir = first_line("-print-file-name=include")
+        if "/" in resource_dir:
+            resource_dir = resource_dir[: resource_dir.rindex("/")]
+
+        fields = {
+            "key": key.replace("\n", " "),
+            "identity": file_identity(path),
+            "path": path,
+            "version": first_line("--version"),
+            "target": first_line("-dumpmachine"),
+            "resource-dir": resource_dir,
+        }
+        # Failing to cache the result only makes the next lookup slower.
+        with contextlib.suppress(OSError):
+            cache_file.parent.mkdir(exist_ok=True)
+            tmp = cache_file.with_name(f"{cache_file.name}.{os.getpid()}.tmp")
+            tmp.write_text("".join(f"{k} {v}\n" for k, v in fields.items()))
+            os.replace(tmp, cache_file)
+
+    _COMPILER_IDENTITY = "\n".join(fields[name] for name in names)
+    return _COMPILER_IDENTITY
+
+
+def compiler_is_clang() -> bool:
+    """Returns whether the compiler is clang, as opposed to gcc."""
+    return "clang" in compiler_identity().split("\n")[1].lower()
+
+
+def archiver() -> str:
+    """Returns the archiver to pack library objects with. Its symbol index has
+    to cover LTO objects, which only the compiler's own archiver is sure to
+    understand."""
+    global C_AR_COMMAND
+    if C_AR_COMMAND is None:
+        C_AR_COMMAND = "llvm-ar" if compiler_is_clang() else "gcc-ar"
+        if shutil.which(C_AR_COMMAND) is None:
+            C_AR_COMMAND = "ar"
+    return C_AR_COMMAND
+
+
+def gc_sections_flag() -> str:
+    """Returns the flag which has the linker drop unused sections."""
+    if get_os() == "macos":
+        return "-Wl,-dead_strip"
+    return "-Wl,--gc-sections"
+
+
+# Compile steps run in the build directory and are given the paths of
+# everything in it relative to it, so neither what they output nor their cache
+# keys depend on where the project or the build directory are. The compiler
+# still puts the directory it ran in in debug info, which this maps to ".".
+PREFIX_MAP = "-ffile-prefix-map="
+
+
+def prefix_map_flag() -> str:
+    return f"{PREFIX_MAP}{C_BUILD_CACHE_DIR.resolve()}=."
+
+
+def build_path(path: pathlib.Path) -> str:
+    """Returns path as compile steps name it: relative to the build
+    directory."""
+    return os.path.relpath(path.resolve(), C_BUILD_CACHE_DIR.resolve())
+
+
+def cache_key(argv: list, inputs: list[pathlib.Path]) -> str:
+    """Computes the object cache key for a compile step.
+
+    The key covers the compiler, the full argv and the contents of every
+    input. An input which is a directory stands for every preprocessed file in
+    it, which includes the module's generated __module.h.
+    """
+    files = []
+    for input in sorted(set(inputs)):
+        if input.is_dir():
+            files.extend(sorted(itertools.chain(input.glob("*.c"), input.glob("*.h"))))
+        else:
+            files.append(input)
+
+    h = hashlib.sha256()
+    h.update(f"cbuild {CACHE_VERSION}\0".encode("utf-8"))
+    h.update(compiler_identity().encode("utf-8") + b"\0")
+    for arg in argv:
+        # The only argument naming the build directory. See prefix_map_flag.
+        if str(arg).startswith(PREFIX_MAP):
+            continue
+        h.update(str(arg).encode("utf-8") + b"\0")
+    for file in files:
+        h.update(build_path(file).encode("utf-8") + b"\0")
+        h.update(hashlib.sha256(file.read_bytes()).digest())
+
+    return h.hexdigest()
+
+
+# The digest of each file hashed so far, along with the mtime and size it had
+# when it was hashed.
+FILE_DIGESTS: dict[pathlib.Path, tuple[int, int, str]] = {}
+# How many sets of dependencies are remembered for each compile command.
+MANIFEST_CANDIDATES = 16
+
+
+def file_digest(path: pathlib.Path) -> Optional[str]:
+    """Returns the sha256 of path's contents, or None if it doesn't exist.
+    A file is only hashed again if its mtime or size changed."""
+    try:
+        stat = path.stat()
+    except OSError:
+        return None
+
+    known = FILE_DIGESTS.get(path)
+    if known is not None and known[:2] == (stat.st_mtime_ns, stat.st_size):
+        return known[2]
+
+    digest = hashlib.sha256(path.read_bytes()).hexdigest()
+    FILE_DIGESTS[path] = (stat.st_mtime_ns, stat.st_size, digest)
+    return digest
+
+
+def parse_depfile(depfile: pathlib.Path) -> list[str]:
+    """Returns the prerequisites listed in a Makefile-style depfile written by
+    the compiler's -MD flag, as the compiler named them."""
+    text = depfile.read_text(encoding="utf-8").replace("\\\n", " ")
+    # The first colon followed by whitespace ends the target.
+    _, _, deps = text.partition(": ")
+    result = []
+    for word in deps.replace("\\ ", "\0").split():
+        result.append(word.replace("\0", " "))
+    return result
+
+
+def manifest_entry(base: str) -> pathlib.Path:
+    return C_OBJECT_CACHE_DIR / "manifests" / base[:2] / base[2:]
+
+
+def manifest_lookup(base: str) -> Optional[str]:
+    """Returns the object cache key for the compile command whose key is
+    base, if the files it read the last times it was run are unchanged.
+
+    Like ccache's direct mode, the key of a compile's output covers exactly
+    the files the compiler said it read, system headers included, so a
+    change to any other file never invalidates it."""
+    try:
+        candidates = json.loads(manifest_entry(base).read_text())
+    except (OSError, json.JSONDecodeError):
+        candidates = []
+
+    key = manifest_match(candidates)
+    if key is not None:
+        return key
+
+    # Other machines may have run the same command on the same files.
+    remote = remote_manifest(base)
+    key = manifest_match(remote)
+    if key is not None:
+        manifest_save(base, [c for c in remote if c["key"] == key] + candidates)
+    return key
+
+
+def manifest_match(candidates: list[dict]) -> Optional[str]:
+    """Returns the key of the first candidate whose files are unchanged."""
+    for candidate in candidates:
+        if all(
+            file_digest(C_BUILD_CACHE_DIR / path) == digest
+            for path, digest in candidate["files"].items()
+        ):
+            return candidate["key"]
+
+    return None
+
+
+def manifest_save(base: str, candidates: list[dict]):
+    entry = manifest_entry(base)
+    entry.parent.mkdir(parents=True, exist_ok=True)
+    tmp = entry.with_name(f"{entry.name}.{os.getpid()}.tmp")
+    tmp.write_text(json.dumps(candidates[:MANIFEST_CANDIDATES]))
+    os.replace(tmp, entry)
+
+
+def manifest_add(base: str, files: list[str]) -> str:
+    """Records that the compile command whose key is base read files, which
+    are relative to the build directory unless they're outside of it,
+    returning the key its output should be cached under."""
+    digests = {}
+    for file in sorted(set(files)):
+        digest = file_digest(C_BUILD_CACHE_DIR / file)
+        assert digest is not None, f"{file} was read by the compiler"
+        digests[file] = digest
+
+    h = hashlib.sha256(base.encode("utf-8"))
+    for path, digest in digests.items():
+        h.update(f"{path}\0{digest}\0".encode("utf-8"))
+    key = h.hexdigest()
+
+    candidate = {"key": key, "files": digests}
+    try:
+        candidates = json.loads(manifest_entry(base).read_text())
+    except (OSError, json.JSONDecodeError):
+        candidates = []
+    manifest_save(base, [candidate] + [c for c in candidates if c["key"] != key])
+
+    if REMOTE is not None:
+        remote = [c for c in remote_manifest(base) if c["key"] != key]
+        data = json.dumps(([candidate] + remote)[:MANIFEST_CANDIDATES])
+        remote_put(f"manifests/{base}", [("manifest", 0o644, data.encode("utf-8"))])
+    return key
+
+
+def cache_entry(key: str) -> pathlib.Path:
+    return C_OBJECT_CACHE_DIR / key[:2] / key[2:]
+
+
+def cache_fetch(key: str, output: pathlib.Path, extra: list[pathlib.Path]) -> bool:
+    """Copies the cached output for key to output, returning whether there was
+    one. The extra outputs stored along with it, such as split DWARF files,
+    are copied too. Outputs which are only in the remote cache are put in the
+    local one first."""
+    entry = cache_entry(key)
+    remote = not entry.exists()
+    if remote and not remote_fetch(key, entry):
+        STATS.record(hit=False)
+        return False
 
-def build(mod: Module, type: Literal["exe", "lib"]):
     if args.verbose:
-        print(f'building module "{mod.import_path}" as {type}')
+        where = "remote cache" if remote else "cache"
+        print(f"{where} hit for {output} ({key})")
+    STATS.record(hit=True, remote=remote)
+    for file in extra:
+        extra_entry = entry.with_name(entry.name + file.suffix)
+        if extra_entry.exists():
+            shutil.copy(extra_entry, file)
+    shutil.copy(entry, output)
+    return True
+
+
+def cache_store(key: str, output: pathlib.Path, extra: list[pathlib.Path]):
+    """Puts output, along with those of the extra outputs the compiler wrote,
+    in the object cache under key, and in the remote cache if there is one.
+    Each extra output is stored under key with its suffix added, so no two may
+    share a suffix."""
+    entry = cache_entry(key)
+    entry.parent.mkdir(parents=True, exist_ok=True)
+    # Copy then rename so a concurrent or interrupted build never sees a
+    # partially written entry. The main output goes last, since its entry
+    # being there is what makes the others count.
+    parts = []
+    for file, file_entry in [
+        (file, entry.with_name(entry.name + file.suffix)) for file in extra
+    ] + [(output, entry)]:
+        if not file.exists():
+            continue
+        tmp = file_entry.with_name(f"{file_entry.name}.{os.getpid()}.tmp")
+        shutil.copy(file, tmp)
+        os.replace(tmp, file_entry)
+        if REMOTE is not None:
+            name = file.suffix if file is not output else "output"
+            parts.append((name, file_entry.stat().st_mode & 0o777, file.read_bytes()))
+
+    if REMOTE is not None:
+        remote_put(f"objects/{key[:2]}/{key[2:]}", parts)
+
+
+class CacheBackend:
+    """CacheBackend is somewhere the object cache can be shared through, like
+    sccache's storage backends. It stores blobs by name, such as
+    objects/<key>, without looking inside them; see pack_blob for how they're
+    checked. Errors are reported by raising OSError."""
+
+    def get(self, name: str) -> Optional[bytes]:
+        """Returns the blob called name, or None if there isn't one."""
+        raise NotImplementedError
+
+    def put(self, name: str, data: bytes):
+        """Stores data as the blob called name, replacing any other."""
+        raise NotImplementedError
+
+
+class DirectoryBackend(CacheBackend):
+    """Keeps blobs as files in a directory, which can be shared by several
+    checkouts, or mounted on several machines."""
+
+    def __init__(self, dir: pathlib.Path):
+        self.dir = dir
+
+    def get(self, name: str) -> Optional[bytes]:
+        try:
+            return (self.dir / name).read_bytes()
+        except FileNotFoundError:
+            return None
 
-    out = C_BUILD_CACHE_DIR / mod.import_path
-    if mod.is_submodule():
-        out = C_BUILD_CACHE_DIR / mod.parent.import_path / mod.module_name()
+    def put(self, name: str, data: bytes):
+        file = self.dir / name
+        file.parent.mkdir(parents=True, exist_ok=True)
+        tmp = file.with_name(f"{file.name}.{os.getpid()}.tmp")
+        tmp.write_bytes(data)
+        os.replace(tmp, file)
+
+
+class HttpBackend(CacheBackend):
+    """Keeps blobs on an HTTP server, which gets a GET request for url/name
+    to fetch a blob, answered with 404 if there isn't one, and a PUT request
+    to store one. tools/cache_server.py is such a server."""
+
+    # How long a request may take before the remote cache is given up on.
+    TIMEOUT = 10
+
+    def __init__(self, url: str):
+        self.url = url.rstrip("/")
+
+    def get(self, name: str) -> Optional[bytes]:
+        try:
+            with urllib.request.urlopen(
+                f"{self.url}/{name}", timeout=self.TIMEOUT
+            ) as resp:
+                return resp.read()
+        except urllib.error.HTTPError as e:
+            if e.code == 404:
+                return None
+            raise
+
+    def put(self, name: str, data: bytes):
+        request = urllib.request.Request(f"{self.url}/{name}", data, method="PUT")
+        with urllib.request.urlopen(request, timeout=self.TIMEOUT) as resp:
+            resp.read()
+
+
+def cache_backend(location: str) -> CacheBackend:
+    """Returns the backend for C_REMOTE_CACHE: an HTTP server for an http://
+    or https:// URL, and a directory for a file:// URL or a path."""
+    if location.startswith(("http://", "https://")):
+        return HttpBackend(location)
+    return DirectoryBackend(pathlib.Path(location.removeprefix("file://")))
+
+
+# The remote cache, if one is configured and hasn't failed.
+REMOTE: Optional[CacheBackend] = None
+BLOB_MAGIC = b"cbuild-blob 1\n"
+
+
+def pack_blob(parts: list[tuple[str, int, bytes]]) -> bytes:
+    """Packs the named files into one blob for the remote cache, along with
+    their permissions. Each file's size and sha256 go before its contents, so
+    one which was truncated or corrupted on the way is caught by
+    unpack_blob."""
+    blob = bytearray(BLOB_MAGIC)
+    for name, mode, data in parts:
+        digest = hashlib.sha256(data).hexdigest()
+        blob += f"{name} {mode:o} {len(data)} {digest}\n".encode("utf-8")
+        blob += data
+    return bytes(blob)
+
+
+def unpack_blob(blob: bytes) -> list[tuple[str, int, bytes]]:
+    """Returns the files packed by pack_blob, raising ValueError if blob
+    isn't exactly what was packed."""
+    if not blob.startswith(BLOB_MAGIC):
+        raise ValueError("not a cache blob")
+
+    parts = []
+    pos = len(BLOB_MAGIC)
+    while pos < len(blob):
+        end = blob.find(b"\n", pos)
+        if end < 0:
+            raise ValueError("truncated")
+        name, mode, size, digest = blob[pos:end].decode("utf-8").split(" ")
+        # Names end up in the names of files in the local cache.
+        if name not in ("output", "manifest") and not (
+            name.startswith(".") and name[1:].isalnum() and name[1:].isascii()
+        ):
+            raise ValueError(f"invalid name '{name}'")
+        data = blob[end + 1 : end + 1 + int(size)]
+        if len(data) != int(size) or hashlib.sha256(data).hexdigest() != digest:
+            raise ValueError(f"{name} doesn't match its checksum")
+        parts.append((name, int(mode, 8), data))
+        pos = end + 1 + int(size)
+    return parts
+
+
+# What a backend may raise when the remote cache is unreachable or returns
+# something which isn't an entry.
+REMOTE_ERRORS = (OSError, ValueError, http.client.HTTPException)
+
+
+def remote_failed(what: str, e: Exception):
+    """Stops using the remote cache for the rest of the build, so a server
+    which is down, or which returns garbage, only costs one request."""
+    global REMOTE
+    if REMOTE is not None:
+        REMOTE = None
+        print(
+            f"warning: couldn't {what} the remote cache, building without it: {e}",
+            file=sys.stderr,
+        )
 
-    out.mkdir(parents=True, exist_ok=True)
 
-    if type == "exe":
-        outname = mod.module_name()
-    else:
-        outname = "lib.o"
+def remote_get(name: str) -> Optional[list[tuple[str, int, bytes]]]:
+    """Returns the files in the remote cache's blob called name, or None if
+    it's missing or corrupt."""
+    backend = REMOTE
+    if backend is None:
+        return None
+    try:
+        blob = backend.get(name)
+        return None if blob is None else unpack_blob(blob)
+    except REMOTE_ERRORS as e:
+        remote_failed("read from", e)
+        return None
 
-    if type == "exe":
-        libfile = "main.c"
-    elif (mod.path / "lib.c").exists():
-        libfile = "lib.c"
-    else:
-        libfile = mod.module_name() + ".c"
-
-    # TODO: This doesn't work since we can specify different platform_flags for
-    #       each library!
-    headers = []
-    sources = []
-    flags = []
-    for dep in mod.dependencies:
-        dep = MOD_CACHE[dep]
-        headers.append(f"--include={dep.h()}")
-        sources.append(dep.lib_c())
-        flags.extend(dep.platform_flags.get(get_os(), []))
-
-    if type == "exe" and mod.has_lib:
-        sources.append(mod.lib_c())
-
-    # assemble compile command
-    argv = [
-        C_CLANG_COMMAND,
-        "-o",
-        str((out / outname).resolve()),
-        f"-std={mod.std}",
-        f"--include={mod.h()}",
-        # TODO: remove if release flag is present.
-        "-fsanitize=address,undefined",
-        "-Wall",
-        "-Wextra",
-        "-Werror=conversion",
-        "-Werror=shadow",
-        "-Wno-sign-conversion",  # so uint - 1 doesn't warn of conversion
-        "-fasynchronous-unwind-tables",  # so _Unwind_* always works.
-        "-Werror=format-security",
-        "-Werror=implicit-function-declaration",
-        "-g3",
-    ]
-    if type == "lib":
-        argv.append("-c")
-    moddir = C_BUILD_CACHE_DIR / mod.import_path
-    argv.append(str((moddir / libfile).resolve()))
-    argv.extend(headers)
-    argv.extend(sources)
-    argv.extend(flags)
+
+def remote_put(name: str, parts: list[tuple[str, int, bytes]]):
+    backend = REMOTE
+    if backend is None:
+        return
+    try:
+        backend.put(name, pack_blob(parts))
+    except REMOTE_ERRORS as e:
+        remote_failed("write to", e)
+
+
+def remote_fetch(key: str, entry: pathlib.Path) -> bool:
+    """Puts the outputs the remote cache has for key in the local cache
+    entry, returning whether it had any."""
+    parts = remote_get(f"objects/{key[:2]}/{key[2:]}")
+    if parts is None or "output" not in [name for name, _, _ in parts]:
+        return False
+
+    entry.parent.mkdir(parents=True, exist_ok=True)
+    # The main output goes last, like in cache_store.
+    parts.sort(key=lambda part: part[0] == "output")
+    for name, mode, data in parts:
+        file_entry = entry if name == "output" else entry.with_name(entry.name + name)
+        tmp = file_entry.with_name(f"{file_entry.name}.{os.getpid()}.tmp")
+        tmp.write_bytes(data)
+        # Only the permission bits cache_store could have stored, so an entry
+        # can't be setuid or writable by others.
+        tmp.chmod(mode & 0o755)
+        os.replace(tmp, file_entry)
+    return True
+
+
+def remote_manifest(base: str) -> list[dict]:
+    """Returns the candidates the remote cache has for the compile command
+    whose key is base. See manifest_lookup."""
+    parts = remote_get(f"manifests/{base}")
+    if parts is None:
+        return []
+    try:
+        candidates = json.loads(parts[0][2])
+        for candidate in candidates:
+            if not isinstance(candidate["key"], str) or not all(
+                isinstance(path, str) and isinstance(digest, str)
+                for path, digest in candidate["files"].items()
+            ):
+                raise ValueError("invalid manifest")
+        return candidates
+    except (IndexError, KeyError, TypeError, AttributeError, ValueError) as e:
+        remote_failed("read from", e)
+        return []
+
+
+# The flags every translation unit is compiled with, whatever the profile.
+COMPILE_FLAGS = [
+    "-Wall",
+    "-Wextra",
+    "-Werror=conversion",
+    "-Werror=shadow",
+    "-Wno-sign-conversion",  # so uint - 1 doesn't warn of conversion
+    "-fasynchronous-unwind-tables",  # so _Unwind_* always works.
+    "-Werror=format-security",
+    "-Werror=implicit-function-declaration",
+    # Puts each function and variable in its own section, so the linker can
+    # drop the ones nothing uses.
+    "-ffunction-sections",
+    "-fdata-sections",
+]
+C_LTO_CACHE_DIR = C_CACHE_DIR / "lto"
+
+
+@dataclass
+class Profile:
+    """Profile is a set of flags to build with, selected with --profile."""
+
+    name: str
+    compile_flags: list[str]
+    link_flags: list[str]
+
+
+def builtin_profile(name: str) -> Optional[Profile]:
+    """Returns the built in profile called name, if there is one."""
+    sanitizers = "-fsanitize=address,undefined"
+    if name == "debug":
+        # Split DWARF keeps the debug info out of the objects, so there's
+        # less for the linker to read and copy.
+        return Profile(name, [sanitizers, "-g3", "-gsplit-dwarf"], [sanitizers])
+    if name == "release":
+        return Profile(name, ["-O2", "-DNDEBUG"], [])
+    if name != "release-lto":
+        return None
+
+    if not compiler_is_clang():
+        # gcc has no ThinLTO or LTO cache, but can at least run the link time
+        # optimization in parallel. It needs the optimization flags when
+        # linking too.
+        flags = ["-O2", "-DNDEBUG", f"-flto={args.jobs}"]
+        return Profile(name, flags, flags)
+
+    link_flags = ["-O2", "-flto=thin", f"-flto-jobs={args.jobs}"]
+    if shutil.which("ld.lld") is not None:
+        C_LTO_CACHE_DIR.mkdir(parents=True, exist_ok=True)
+        link_flags += [
+            "-fuse-ld=lld",
+            f"-Wl,--thinlto-cache-dir={build_path(C_LTO_CACHE_DIR)}",
+        ]
+    return Profile(name, ["-O2", "-DNDEBUG", "-flto=thin"], link_flags)
+
+
+def select_profile(name: str, root: Module) -> Profile:
+    """Returns the profile called name, with the flags the project's c.mod
+    adds to it."""
+    result = builtin_profile(name)
+    if result is None:
+        if name not in root.profiles:
+            error(f"no profile named '{name}'")
+        result = Profile(name, [], [])
+
+    for flag in root.profiles.get(name, []):
+        if is_link_flag(flag):
+            result.link_flags.append(flag)
+        else:
+            result.compile_flags.append(flag)
+    return result
+
+
+# The profile being built with. Set once the project is loaded, since c.mod can
+# declare profiles.
+PROFILE: Profile
+
+
+def is_link_flag(flag: str) -> bool:
+    """Returns whether a flag from c.mod is only meaningful when linking."""
+    return flag.startswith(("-l", "-L", "-Wl,"))
+
+
+def transitive_dependencies(mod: Module) -> list[Module]:
+    """Returns every module mod depends on, directly or not, sorted by import
+    path so the commands built from it are the same on every run."""
+    seen = set()
+    stack = list(mod.dependencies)
+    while len(stack) != 0:
+        dep = stack.pop()
+        if dep in seen or dep == mod.import_path:
+            continue
+        seen.add(dep)
+        stack.extend(MOD_CACHE[dep].dependencies)
+
+    return [MOD_CACHE[dep] for dep in sorted(seen)]
+
+
+def link_order(mod: Module) -> list[Module]:
+    """Returns mod and every module it depends on which has a library, in the
+    order their archives are given to the linker. The linker only takes what
+    is still undefined out of an archive, so each module has to come before
+    the ones it imports. A module depends on more modules than anything it
+    imports does, so sorting by that is enough."""
+    mods = [dep for dep in [mod] + transitive_dependencies(mod) if dep.has_lib]
+    mods.sort(key=lambda dep: len(transitive_dependencies(dep)), reverse=True)
+    return mods
+
+
+def quoted_include(line: str) -> Optional[str]:
+    """Returns the path in line if it is an #include of a quoted path."""
+    line = line.strip().split(maxsplit=1)
+    if len(line) != 2 or line[0] != "#include" or not line[1].startswith('"'):
+        return None
+
+    return line[1].strip('"')
+
+
+def inline_file(path: pathlib.Path, seen: set[pathlib.Path]) -> list[str]:
+    """Returns the lines of the preprocessed file at path, with every quoted
+    #include of another file in the build cache replaced by the file's own
+    lines. Files in seen are left out, and every file inlined is added to it.
+    A #line marker after each inlined file keeps diagnostics pointing at the
+    right line of the file which included it."""
+    path = path.resolve()
+    if path in seen:
+        return []
+    seen.add(path)
+
+    result = []
+    # Preprocessed files start with a #line marker naming them.
+    name = None
+    lines = path.read_text(encoding="utf-8").split("\n")
+    for i in range(len(lines)):
+        if i == 0 and lines[i].startswith("#line 1 "):
+            name = lines[i].split('"')[1]
+        include = quoted_include(lines[i])
+        if include is None:
+            result.append(lines[i])
+            continue
+
+        target = (path.parent / include).resolve()
+        if not target.is_relative_to(C_BUILD_CACHE_DIR.resolve()):
+            result.append(lines[i])
+            continue
+
+        result.extend(inline_file(target, seen))
+        if name is not None:
+            result.append(f'#line {i + 1} "{name}"')
+
+    return result
+
+
+def write_amalgamation(mod: Module, dir: pathlib.Path) -> list[pathlib.Path]:
+    """Writes mod as an amalgamation to dir, returning the files written:
+
+    - <name>.h: the headers of mod and everything it imports.
+    - <name>.c: the sources of mod's library and those of everything it
+      imports, if mod has a library.
+    - main.c: the same, plus mod's main.c, if mod has an executable.
+
+    Everything but system headers is inlined, so the files can be compiled
+    by themselves. Files are left alone if their contents didn't change."""
+    deps = transitive_dependencies(mod)
+    name = mod.module_name()
+    seen = set()
+    header = []
+    for h in [mod.h()] + [dep.h() for dep in deps]:
+        header.extend(inline_file(h, seen))
+
+    libs = [f'#include "./{name}.h"']
+    for dep in deps + [mod]:
+        if dep.has_lib:
+            libs.extend(inline_file(dep.lib_c(), seen))
+
+    files = {dir / f"{name}.h": header}
+    if mod.has_lib:
+        files[dir / f"{name}.c"] = libs
+    if mod.has_executable:
+        files[dir / "main.c"] = libs + inline_file(mod.main_c(), seen)
+
+    dir.mkdir(parents=True, exist_ok=True)
+    for file, lines in files.items():
+        text = "\n".join(lines) + "\n"
+        if not file.exists() or file.read_text(encoding="utf-8") != text:
+            file.write_text(text, encoding="utf-8")
+    return list(files)
+
+
+@dataclass(eq=False)
+class Job:
+    """A single compiler invocation in the build graph. It's run in the build
+    directory; see prefix_map_flag."""
+
+    description: str
+    argv: list[str]
+    output: pathlib.Path
+    # The files the output is built from. A directory stands for all the
+    # preprocessed files in it.
+    inputs: list[pathlib.Path]
+    deps: list["Job"] = field(default_factory=list)
+    # Where to copy the output once it is built, if anywhere.
+    install: Optional[pathlib.Path] = None
+    # The phase of the build the job is part of, for --trace.
+    phase: str = "compile"
+    # Where the compiler writes the files it read, if it's asked to. When
+    # set, the output is cached by those files instead of inputs.
+    depfile: Optional[pathlib.Path] = None
+    # The files the compiler writes next to the output, such as split DWARF
+    # files, which are cached along with it.
+    extra_outputs: list[pathlib.Path] = field(default_factory=list)
+
+    def run(self) -> subprocess.CompletedProcess[bytes]:
+        """Builds the job's output, returning the compiler's result if it had
+        to be called and None on a cache hit."""
+        subject = self.description.split(" ", maxsplit=1)[-1]
+        with TRACE.span(self.phase, subject, argv=self.argv) as span:
+            span["hit"] = False
+            result = self._run()
+            span["hit"] = result is None
+            if result is not None:
+                span["returncode"] = result.returncode
+            return result
+
+    def _run(self) -> subprocess.CompletedProcess[bytes]:
+        if self.depfile is None:
+            key = cache_key(self.argv, self.inputs)
+            if cache_fetch(key, self.output, self.extra_outputs):
+                return None
+        else:
+            base = cache_key(self.argv, [])
+            key = manifest_lookup(base)
+            if key is None:
+                STATS.record(hit=False)
+            elif cache_fetch(key, self.output, self.extra_outputs):
+                return None
+
+        if args.verbose:
+            print(self.description)
+            print(" ".join(map(str, self.argv)))
+        # Capture the output so diagnostics from jobs running in parallel
+        # don't get interleaved.
+        result = subprocess.run(
+            self.argv,
+            cwd=C_BUILD_CACHE_DIR,
+            stdout=subprocess.PIPE,
+            stderr=subprocess.STDOUT,
+        )
+        if result.returncode == 0:
+            if self.depfile is not None:
+                # The outputs of the jobs this one depends on, such as a
+                # precompiled header, aren't always listed in the depfile.
+                files = parse_depfile(self.depfile)
+                files.extend(build_path(dep.output) for dep in self.deps)
+                key = manifest_add(base, files)
+            cache_store(key, self.output, self.extra_outputs)
+        return result
+
+
+class BuildGraph:
+    """BuildGraph holds the compile and link jobs needed to build a set of
+    modules. Every library module is compiled to its own object exactly once,
+    and executables are linked from those objects."""
+
+    def __init__(self):
+        # Every job in the graph, indexed by its output.
+        self.jobs: dict[pathlib.Path, Job] = {}
+
+    def _add(self, job: Job) -> Job:
+        if job.output in self.jobs:
+            return self.jobs[job.output]
+
+        self.jobs[job.output] = job
+        return job
+
+    def _platform_flags(self, mod: Module) -> list[str]:
+        """Returns the compile flags mod and its dependencies ask for in their
+        c.mod files."""
+        flags = []
+        for dep in [mod] + transitive_dependencies(mod):
+            for flag in dep.platform_flags.get(get_os(), []):
+                if not is_link_flag(flag):
+                    flags.append(flag)
+        return flags
+
+    def _inputs(self, mod: Module) -> list[pathlib.Path]:
+        inputs = [C_BUILD_CACHE_DIR / mod.import_path]
+        for dep in transitive_dependencies(mod):
+            inputs.append(C_BUILD_CACHE_DIR / dep.import_path)
+        return inputs
+
+    def _prelude(self, mod: Module) -> Job:
+        """Adds the job which precompiles the headers every translation unit
+        of mod starts with: its own __module.h followed by those of its
+        dependencies. The compiler only takes one precompiled header per
+        translation unit, so this is done per module rather than per
+        __module.h."""
+        dir = mod.output_dir() / ".pch"
+        prelude = dir / "prelude.h"
+        # gcc looks for prelude.h.gch itself when prelude.h is included, while
+        # clang has to be given the file.
+        output = dir / ("prelude.h.pch" if compiler_is_clang() else "prelude.h.gch")
+        if output in self.jobs:
+            return self.jobs[output]
+
+        text = ""
+        for header in [mod.h()] + [dep.h() for dep in transitive_dependencies(mod)]:
+            text += f'#include "{os.path.relpath(header, dir.resolve())}"\n'
+        dir.mkdir(parents=True, exist_ok=True)
+        # Leave it alone if it didn't change, like __module.h.
+        if not prelude.exists() or prelude.read_text() != text:
+            prelude.write_text(text)
+
+        depfile = dir / "prelude.d"
+        argv = [
+            C_CLANG_COMMAND,
+            "-x",
+            "c-header",
+            "-o",
+            build_path(output),
+            "-MD",
+            "-MF",
+            build_path(depfile),
+            prefix_map_flag(),
+        ]
+        argv.append(f"-std={mod.std}")
+        argv.extend(COMPILE_FLAGS)
+        argv.extend(PROFILE.compile_flags)
+        argv.extend(self._platform_flags(mod))
+        argv.append(build_path(prelude))
+        argv = list(dict.fromkeys(argv))
+
+        return self._add(
+            Job(
+                description=f"precompiling {mod.import_path}/__module.h",
+                argv=argv,
+                output=output,
+                inputs=self._inputs(mod),
+                phase="pch",
+                depfile=depfile,
+            )
+        )
+
+    def _compile(
+        self,
+        mod: Module,
+        source: pathlib.Path,
+        output: pathlib.Path,
+        amalgamation: bool = False,
+    ) -> Job:
+        """Adds the job which compiles source, one of mod's files, to output.
+        An amalgamation already contains every header it needs."""
+        depfile = output.with_suffix(".d")
+        argv = [
+            C_CLANG_COMMAND,
+            "-c",
+            "-o",
+            build_path(output),
+            "-MD",
+            "-MF",
+            build_path(depfile),
+            prefix_map_flag(),
+        ]
+        deps = []
+        headers = []
+        if not amalgamation and args.pch:
+            pch = self._prelude(mod)
+            deps.append(pch)
+            if compiler_is_clang():
+                headers = ["-include-pch", build_path(pch.output)]
+            else:
+                headers = ["-include", build_path(pch.output.with_suffix(""))]
+        elif not amalgamation:
+            headers.append(f"--include={build_path(mod.h())}")
+            for dep in transitive_dependencies(mod):
+                headers.append(f"--include={build_path(dep.h())}")
+
+        argv.append(f"-std={mod.std}")
+        argv.extend(headers)
+        argv.extend(COMPILE_FLAGS)
+        argv.extend(PROFILE.compile_flags)
+        argv.append(build_path(source))
+        argv.extend(self._platform_flags(mod))
+        # remove duplicates
+        argv = list(dict.fromkeys(argv))
+        extra_outputs = []
+        if "-gsplit-dwarf" in argv:
+            extra_outputs.append(output.with_suffix(".dwo"))
+
+        return self._add(
+            Job(
+                description=f"compiling {mod.import_path}/{source.name}",
+                argv=argv,
+                output=output,
+                inputs=self._inputs(mod),
+                deps=deps,
+                depfile=depfile,
+                extra_outputs=extra_outputs,
+            )
+        )
+
+    def lib(self, mod: Module) -> Job:
+        """Adds the jobs which compile mod's library to lib.o and pack it into
+        a static archive, so executables only link in what they use."""
+        if mod.archive() in self.jobs:
+            return self.jobs[mod.archive()]
+
+        obj = self._compile(mod, mod.lib_c(), mod.lib())
+        argv = [
+            archiver(),
+            "rcs",
+            build_path(mod.archive()),
+            build_path(mod.lib()),
+        ]
+        return self._add(
+            Job(
+                description=f"archiving {mod.import_path}",
+                argv=argv,
+                output=mod.archive(),
+                inputs=[mod.lib()],
+                deps=[obj],
+                phase="archive",
+            )
+        )
+
+    def exe(self, mod: Module) -> Job:
+        """Adds the jobs which build mod's executable."""
+        if mod.exe() in self.jobs:
+            return self.jobs[mod.exe()]
+
+        if args.unity:
+            # The whole executable is one translation unit.
+            dir = C_BUILD_CACHE_DIR / mod.import_path / ".unity"
+            write_amalgamation(mod, dir)
+            output = mod.output_dir() / ".unity" / "main.o"
+            deps = [self._compile(mod, dir / "main.c", output, True)]
+        else:
+            main = self._compile(mod, mod.main_c(), mod.output_dir() / "main.o")
+            deps = [main] + [self.lib(dep) for dep in link_order(mod)]
+
+        flags = []
+        for dep in [mod] + transitive_dependencies(mod):
+            for flag in dep.platform_flags.get(get_os(), []):
+                if is_link_flag(flag):
+                    flags.append(flag)
+
+        argv = [C_CLANG_COMMAND, "-o", build_path(mod.exe())]
+        argv.extend(PROFILE.link_flags)
+        argv.append(gc_sections_flag())
+        argv.extend(build_path(dep.output) for dep in deps)
+        argv.extend(flags)
+        argv = list(dict.fromkeys(argv))
+
+        return self._add(
+            Job(
+                description=f"linking {mod.import_path}",
+                argv=argv,
+                output=mod.exe(),
+                inputs=[dep.output for dep in deps],
+                deps=deps,
+                install=mod.path,
+                phase="link",
+            )
+        )
+
+    def run(self, jobs: int, changed: Optional[set[pathlib.Path]] = None):
+        """Runs every job in the graph, running up to jobs of them at once.
+        A job is started as soon as all of its dependencies are done.
+
+        If changed is given, the outputs from a previous run are assumed to
+        be up to date except for the jobs which read one of the paths in it,
+        and the jobs depending on those."""
+        waiting = {job: len(job.deps) for job in self.jobs.values()}
+        dependents = {job: [] for job in self.jobs.values()}
+        for job in self.jobs.values():
+            for dep in job.deps:
+                dependents[dep].append(job)
+
+        ready = [job for job, count in waiting.items() if count == 0]
+        running = {}
+        failed = 0
+        # The jobs which were run, as opposed to skipped.
+        rerun = set()
+
+        def finish(job: Job):
+            for dependent in dependents[job]:
+                waiting[dependent] -= 1
+                if waiting[dependent] == 0:
+                    ready.append(dependent)
+
+        with concurrent.futures.ThreadPoolExecutor(
+            max_workers=jobs, thread_name_prefix="compile"
+        ) as pool:
+            while len(ready) != 0 or len(running) != 0:
+                while len(ready) != 0 and failed == 0:
+                    job = ready.pop()
+                    if (
+                        changed is not None
+                        and job.output.exists()
+                        and not any(input in changed for input in job.inputs)
+                        and not any(dep in rerun for dep in job.deps)
+                    ):
+                        finish(job)
+                        continue
+
+                    rerun.add(job)
+                    job.output.parent.mkdir(parents=True, exist_ok=True)
+                    running[pool.submit(job.run)] = job
+                if len(running) == 0:
+                    break
+
+                done, _ = concurrent.futures.wait(
+                    running, return_when=concurrent.futures.FIRST_COMPLETED
+                )
+                for future in done:
+                    job = running.pop(future)
+                    result = future.result()
+                    if result is not None:
+                        sys.stdout.write(result.stdout.decode("utf-8"))
+                        sys.stdout.flush()
+                        if result.returncode != 0:
+                            # Let the jobs which are already running finish,
+                            # but don't start any new ones.
+                            failed = result.returncode
+                            continue
+
+                    if job.install is not None:
+                        shutil.copy(job.output, job.install)
+                    finish(job)
+
+        if failed != 0:
+            exit(failed)
+
+
+def write_inputs(mod: Module, started: int):
+    """Writes the manifest crun checks to run mod's executable without
+    building first. It holds the toolchain's fingerprint and the
+    modification time of every file and directory the executable was built
+    from, along with the installed executable itself. Kept in sync with
+    write_inputs in cbuild/cbuild.c.
+
+    If a source file changed after started, the build may not have seen the
+    change, so no manifest is written and crun builds again."""
+    fingerprint = f"{fnv1a(compiler_identity()):016x}"
+    lines = [f"toolchain {fingerprint}"]
+    paths = [mod.path / mod.module_name()]
+    for dep in [mod] + transitive_dependencies(mod):
+        root = dep
+        while root.parent is not None:
+            root = root.parent
+        paths.append(root.path / "c.mod")
+        paths.append(dep.path)
+        paths.extend(
+            sorted(itertools.chain(dep.path.glob("*.c"), dep.path.glob("*.h")))
+        )
+
+    manifest = mod.inputs()
+    with contextlib.suppress(OSError):
+        manifest.unlink()
+    for path in dict.fromkeys(path.resolve() for path in paths):
+        try:
+            ns = path.stat().st_mtime_ns
+        except OSError:
+            return
+        if ns >= started and (is_source(path) or path.name == "c.mod"):
+            return
+        lines.append(f"input {ns} {path}")
+
+    tmp = manifest.with_name(f"{manifest.name}.{os.getpid()}.tmp")
+    tmp.write_text("".join(line + "\n" for line in lines))
+    os.replace(tmp, manifest)
+
+
+def build(mods: list[Module], changed: Optional[set[pathlib.Path]] = None):
+    """Builds the executables for every module in mods as one graph, so
+    libraries they have in common are only compiled once. See BuildGraph.run
+    for changed."""
+    started = time.time_ns()
+    graph = BuildGraph()
+    for mod in mods:
+        if args.verbose:
+            print(f'building module "{mod.import_path}" as exe')
+        graph.exe(mod)
+    graph.run(args.jobs, changed)
+    for mod in mods:
+        write_inputs(mod, started)
+
+
+# The module graph index. It has a header, then a table of stamps, a table of
+# modules, an array of words the modules' lists are stored in, and the
+# strings everything refers to by offset. All integers are little-endian.
+INDEX_MAGIC = b"CMIX"
+INDEX_VERSION = 1
+# magic, version, OS, stamp count, module count, word count
+INDEX_HEADER = struct.Struct("<4sIIIII")
+# path, modification time in nanoseconds or -1 if it doesn't exist
+INDEX_STAMP = struct.Struct("<Iq")
+# import path, path, std, flags, parent, then the first word and word count
+# of the submodules, platform flags, profiles and dependencies
+INDEX_MODULE = struct.Struct("<13I")
+INDEX_HAS_EXECUTABLE = 1
+INDEX_HAS_LIB = 2
+# Stands for None where a string or module is expected.
+INDEX_NONE = 0xFFFFFFFF
+
+
+def index_file() -> pathlib.Path:
+    """Returns where the index of the project in the current directory
+    goes. Import paths always start with a domain name, so a dot-prefixed
+    name can't collide with a module's build directory."""
+    return C_BUILD_CACHE_DIR / ".index" / f"{fnv1a(str(pathlib.Path.cwd())):016x}"
+
+
+def index_stamps() -> list[pathlib.Path]:
+    """Returns the paths whose modification times tell whether the modules
+    in MOD_CACHE are still laid out the same way: the directory of every
+    project, along with its c.mod and every directory in it, and c.sum.
+    Adding or removing a file changes the modification time of the
+    directory it's in."""
+    stamps = [pathlib.Path("c.sum")]
+    for mod in MOD_CACHE.values():
+        if mod.parent is not None:
+            continue
+        stamps.append(mod.path)
+        stamps.append(mod.path / "c.mod")
+        for child in sorted(mod.path.iterdir()):
+            if child.is_dir() and not child.name.startswith("."):
+                stamps.append(child)
+    return stamps
+
+
+def mtime_ns(path: pathlib.Path) -> int:
+    try:
+        return path.stat().st_mtime_ns
+    except FileNotFoundError:
+        return -1
+
+
+def save_index(started: int):
+    """Writes every module in MOD_CACHE to the index, unless it's already
+    there. If the layout changed after started, it may have changed after
+    it was looked at, so nothing is written and the next build discovers it
+    again."""
+    strings = bytearray()
+    offsets: dict[str, int] = {}
+
+    def string(s: Optional[str]) -> int:
+        if s is None:
+            return INDEX_NONE
+        if s not in offsets:
+            offsets[s] = len(strings)
+            strings.extend(s.encode("utf-8") + b"\0")
+        return offsets[s]
+
+    words: list[int] = []
+
+    def push(values: list[int]) -> tuple[int, int]:
+        words.extend(values)
+        return len(words) - len(values), len(values)
+
+    def flags_map(flags: dict[str, list[str]]) -> tuple[int, int]:
+        values = []
+        for key, value in flags.items():
+            values.extend([string(key), len(value)] + [string(v) for v in value])
+        return push(values)
+
+    stamps = bytearray()
+    stamp_paths = index_stamps()
+    for path in stamp_paths:
+        ns = mtime_ns(path)
+        if ns >= started:
+            return
+        stamps += INDEX_STAMP.pack(string(str(path)), ns)
+
+    import_paths = sorted(MOD_CACHE)
+    index = {import_path: i for i, import_path in enumerate(import_paths)}
+    modules = bytearray()
+    for import_path in import_paths:
+        mod = MOD_CACHE[import_path]
+        flags = INDEX_HAS_EXECUTABLE if mod.has_executable else 0
+        flags |= INDEX_HAS_LIB if mod.has_lib else 0
+        parent = INDEX_NONE if mod.parent is None else index[mod.parent.import_path]
+        deps = sorted(index[dep] for dep in mod.dependencies if dep in index)
+        modules += INDEX_MODULE.pack(
+            string(mod.import_path),
+            string(str(mod.path)),
+            string(mod.std),
+            flags,
+            parent,
+            *push([string(name) for name in mod.submodules]),
+            *flags_map(mod.platform_flags),
+            *flags_map(mod.profiles),
+            *push(deps),
+        )
+
+    header = INDEX_HEADER.pack(
+        INDEX_MAGIC,
+        INDEX_VERSION,
+        string(get_os()),
+        len(stamp_paths),
+        len(import_paths),
+        len(words),
+    )
+    data = (
+        header + stamps + modules + struct.pack(f"<{len(words)}I", *words) + strings
+    )
+    file = index_file()
+    with contextlib.suppress(OSError):
+        if file.read_bytes() == data:
+            return
+    file.parent.mkdir(exist_ok=True)
+    tmp = file.with_name(f"{file.name}.{os.getpid()}.tmp")
+    tmp.write_bytes(data)
+    os.replace(tmp, file)
+
+
+def load_index() -> Optional[dict[pathlib.Path, list[Module]]]:
+    """Returns the modules in the index, without reading any c.mod or looking
+    for any submodules, by the directory of the project they're in. Each
+    project's modules come after the modules they depended on in the last
+    build. Returns None if the index is missing, or if any of its stamps
+    changed, in which case everything has to be discovered again."""
+    try:
+        with open(index_file(), "rb") as f, mmap.mmap(
+            f.fileno(), 0, access=mmap.ACCESS_READ
+        ) as data:
+            return read_index(data)
+    except (OSError, ValueError, struct.error, UnicodeDecodeError):
+        return None
+
+
+def read_index(data: mmap.mmap) -> Optional[dict[pathlib.Path, list[Module]]]:
+    magic, version, index_os, stamp_count, module_count, word_count = (
+        INDEX_HEADER.unpack_from(data, 0)
+    )
+    if magic != INDEX_MAGIC or version != INDEX_VERSION:
+        return None
+    stamps_at = INDEX_HEADER.size
+    modules_at = stamps_at + stamp_count * INDEX_STAMP.size
+    words_at = modules_at + module_count * INDEX_MODULE.size
+    strings_at = words_at + word_count * 4
+    words = struct.unpack_from(f"<{word_count}I", data, words_at)
+
+    def string(offset: int) -> Optional[str]:
+        if offset == INDEX_NONE:
+            return None
+        start = strings_at + offset
+        end = data.find(b"\0", start)
+        if end < 0:
+            raise ValueError("unterminated string in the index")
+        return data[start:end].decode("utf-8")
+
+    def flags_map(first: int, count: int) -> dict[str, list[str]]:
+        result = {}
+        i = first
+        while i < first + count:
+            key, n = words[i], words[i + 1]
+            result[string(key)] = [string(w) for w in words[i + 2 : i + 2 + n]]
+            i += 2 + n
+        return result
+
+    if string(index_os) != get_os():
+        return None
+    for i in range(stamp_count):
+        path, ns = INDEX_STAMP.unpack_from(data, stamps_at + i * INDEX_STAMP.size)
+        if mtime_ns(pathlib.Path(string(path))) != ns:
+            return None
+
+    mods = []
+    parents = []
+    deps = []
+    for i in range(module_count):
+        fields = INDEX_MODULE.unpack_from(data, modules_at + i * INDEX_MODULE.size)
+        import_path, path, std, flags, parent = fields[:5]
+        submodules, platform_flags, profiles, dependencies = (
+            fields[5:7],
+            fields[7:9],
+            fields[9:11],
+            fields[11:13],
+        )
+        mods.append(
+            Module(
+                std=string(std),
+                has_executable=flags & INDEX_HAS_EXECUTABLE != 0,
+                has_lib=flags & INDEX_HAS_LIB != 0,
+                path=pathlib.Path(string(path)),
+                import_path=string(import_path),
+                submodules=[
+                    string(w)
+                    for w in words[submodules[0] : submodules[0] + submodules[1]]
+                ],
+                platform_flags=flags_map(*platform_flags),
+                profiles=flags_map(*profiles),
+            )
+        )
+        parents.append(parent)
+        deps.append(words[dependencies[0] : dependencies[0] + dependencies[1]])
+
+    for mod, parent in zip(mods, parents):
+        if parent != INDEX_NONE:
+            mod.parent = mods[parent]
+
+    # Depth first, so every module comes after its dependencies.
+    projects: dict[pathlib.Path, list[Module]] = {}
+    seen = set()
+
+    def visit(i: int):
+        if i in seen:
+            return
+        seen.add(i)
+        for dep in deps[i]:
+            visit(dep)
+        root = mods[i] if mods[i].parent is None else mods[i].parent
+        projects.setdefault(root.path, []).append(mods[i])
+
+    for i in range(module_count):
+        visit(i)
+    return projects
+
+
+def load_project() -> Module:
+    """Loads the project in the current directory, downloading and
+    preprocessing everything it needs.
+
+    When the index says nothing is laid out differently than in the last
+    build, the modules are taken from it instead of being discovered, and
+    nothing is downloaded up front. The modules are still preprocessed, which
+    finds any imports added since."""
+    global LOCKFILE, PROFILE, INDEXED
+    LOCKFILE = Lockfile(pathlib.Path("c.sum"))
+    started = time.time_ns()
+    with TRACE.span("index", str(pathlib.Path.cwd())) as span:
+        INDEXED = load_index() or {}
+        span["hit"] = len(INDEXED) != 0
+    if len(INDEXED) == 0:
+        prefetch(pathlib.Path("."), parse_modfile(pathlib.Path("c.mod")).import_path)
+        PROBES.save()
+    root = Module.from_directory(pathlib.Path("."))
+    # Everything the project imports has been resolved at this point.
+    LOCKFILE.save()
+    save_index(started)
+    PROFILE = select_profile(args.profile, root)
+    return root
+
+
+def select_targets(root: Module) -> list[Module]:
+    """Returns the modules args.modules asks to build."""
+    modules = args.modules
+    if len(modules) == 0:
+        modules = ["."]
+
+    targets = []
+    for module in modules:
+        if module == "./...":
+            # Every executable in the project.
+            if root.has_executable:
+                targets.append(root)
+            for submod in sorted(root.submodules):
+                mod = root.get_submodule(submod)
+                if mod.has_executable:
+                    targets.append(mod)
+            continue
+
+        if module == ".":
+            if not root.has_executable:
+                error(f"no executable to build for module '{root.import_path}'")
+            targets.append(root)
+            continue
+
+        module = module.removeprefix("./").rstrip("/")
+        if module not in root.submodules:
+            error(f"no submodule named '{module}' exists")
+
+        mod = root.get_submodule(module)
+        if not mod.has_executable:
+            error(f"no executable to build for module '{module}'")
+        targets.append(mod)
+
+    if len(targets) == 0:
+        error(f"no executables to build in module '{root.import_path}'")
 
     # remove duplicates
-    argv = list(dict.fromkeys(argv))
+    return list({mod.import_path: mod for mod in targets}.values())
+
+
+# The inotify_event flags Watcher cares about, from <sys/inotify.h>.
+IN_CLOSE_WRITE = 0x8
+IN_MOVED_FROM = 0x40
+IN_MOVED_TO = 0x80
+IN_CREATE = 0x100
+IN_DELETE = 0x200
+# How long to wait for more events after the first one, so every file written
+# by a single save is picked up by the same rebuild.
+WATCH_SETTLE_TIME = 0.01
+
+
+class Watcher:
+    """Watcher waits for files in a set of directories to change. It uses
+    inotify where available, and polls the directories otherwise."""
+
+    def __init__(self):
+        self.fd = -1
+        # The directory each inotify watch descriptor is for.
+        self.wds: dict[int, pathlib.Path] = {}
+        self.dirs: list[pathlib.Path] = []
+        # When polling, the modification time of every file seen.
+        self.mtimes: dict[pathlib.Path, int] = {}
+        try:
+            self.libc = ctypes.CDLL(None, use_errno=True)
+            self.fd = self.libc.inotify_init1(os.O_CLOEXEC)
+        except (OSError, AttributeError):
+            pass
+
+    def watch(self, dirs: list[pathlib.Path]):
+        """Replaces the directories being watched with dirs."""
+        dirs = [dir.resolve() for dir in dirs]
+        if dirs == self.dirs:
+            return
+
+        self.dirs = dirs
+        if self.fd < 0:
+            self.mtimes = self._scan()
+            return
+
+        for wd in self.wds:
+            self.libc.inotify_rm_watch(self.fd, wd)
+        self.wds = {}
+        mask = IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_CREATE | IN_DELETE
+        for dir in dirs:
+            wd = self.libc.inotify_add_watch(self.fd, str(dir).encode(), mask)
+            if wd < 0:
+                error(f"couldn't watch {dir}: {os.strerror(ctypes.get_errno())}")
+            self.wds[wd] = dir
+
+    def _scan(self) -> dict[pathlib.Path, int]:
+        result = {}
+        for dir in self.dirs:
+            for child in dir.iterdir():
+                try:
+                    result[child] = child.stat().st_mtime_ns
+                except OSError:
+                    pass
+        return result
+
+    def _read(self, timeout: Optional[float]) -> set[pathlib.Path]:
+        ready, _, _ = select.select([self.fd], [], [], timeout)
+        if len(ready) == 0:
+            return set()
+
+        result = set()
+        data = os.read(self.fd, 64 * 1024)
+        offset = 0
+        while offset < len(data):
+            wd, _, _, length = struct.unpack_from("iIII", data, offset)
+            offset += struct.calcsize("iIII")
+            name = data[offset : offset + length].rstrip(b"\0").decode()
+            offset += length
+            if wd in self.wds and len(name) != 0:
+                result.add(self.wds[wd] / name)
+        return result
+
+    def _poll(self, timeout: Optional[float]) -> set[pathlib.Path]:
+        deadline = None if timeout is None else time.monotonic() + timeout
+        while True:
+            mtimes = self._scan()
+            changed = {
+                path
+                for path in mtimes.keys() | self.mtimes.keys()
+                if mtimes.get(path) != self.mtimes.get(path)
+            }
+            self.mtimes = mtimes
+            if len(changed) != 0 or (
+                deadline is not None and time.monotonic() >= deadline
+            ):
+                return changed
+            time.sleep(0.1)
+
+    def wait(self) -> set[pathlib.Path]:
+        """Waits until something in the watched directories changes, returning
+        the paths which changed."""
+        wait = self._read if self.fd >= 0 else self._poll
+        result = wait(None)
+        while True:
+            more = wait(WATCH_SETTLE_TIME)
+            if len(more) == 0:
+                return result
+            result |= more
+
+
+def is_source(path: pathlib.Path) -> bool:
+    return path.suffix in (".c", ".h")
+
+
+def watch(root: Module, targets: list[Module]):
+    """Rebuilds targets whenever a file in the project changes. The module
+    graph is kept between builds, and only the modules whose files changed
+    are preprocessed again. Everything is reloaded if a c.mod file changes or
+    a module is added or removed."""
+    watcher = Watcher()
+    # The build directories of the modules which changed since the last
+    # successful build.
+    changed: set[pathlib.Path] = set()
+    built = True
+    while True:
+        mods = [root] + [root.get_submodule(name) for name in root.submodules]
+        # Directories which aren't modules yet are watched too, so one
+        # becoming a module is noticed.
+        dirs = [
+            dir
+            for dir in sorted(root.path.iterdir())
+            if dir.is_dir() and not dir.name.startswith(".")
+        ]
+        watcher.watch([root.path] + dirs)
+        if built:
+            print("watching for changes...")
+            sys.stdout.flush()
+        paths = watcher.wait()
+
+        start = time.perf_counter()
+        by_dir = {mod.path.resolve(): mod for mod in mods}
+        changed_mods = {}
+        reload = False
+        for path in paths:
+            mod = by_dir.get(path.parent)
+            if path.name == "c.mod" or path.resolve() in by_dir or path.is_dir():
+                # A module may have been added or removed.
+                reload = True
+                continue
+            if mod is None and is_source(path):
+                reload = True
+                continue
+            if mod is None or not is_source(path):
+                continue
+
+            has_exe = (mod.path / "main.c").exists()
+            has_lib = (mod.path / "lib.c").exists() or (
+                mod.path / (mod.module_name() + ".c")
+            ).exists()
+            if has_exe != mod.has_executable or has_lib != mod.has_lib:
+                reload = True
+            changed_mods[mod.import_path] = mod
+
+        try:
+            if reload:
+                if args.verbose:
+                    print("reloading project")
+                MOD_CACHE.clear()
+                GENERATED_HEADERS.clear()
+                root = load_project()
+                targets = select_targets(root)
+                build(targets)
+            elif len(changed_mods) != 0:
+                for mod in changed_mods.values():
+                    # The imports are found again as the module is
+                    # preprocessed.
+                    mod.dependencies = set()
+                    Module._preprocess_dir(mod)
+                    GENERATED_HEADERS.discard(mod.import_path)
+                    changed.add(C_BUILD_CACHE_DIR / mod.import_path)
+                LOCKFILE.save()
+                build(targets, changed)
+            else:
+                built = False
+                continue
+        except SystemExit:
+            # The error was already reported; wait for it to be fixed.
+            built = True
+            continue
+
+        changed = set()
+        built = True
+        print(f"built in {(time.perf_counter() - start) * 1000:.0f}ms")
+        if args.run:
+            run_target(targets[0])
 
-    if args.verbose:
-        print(f"building module {mod.import_path} with -std={mod.std} as {type}")
-        print(" ".join(map(str, argv)))
-    clang = subprocess.run(argv)
-    if clang.returncode != 0:
-        exit(clang.returncode)
 
-    if type == "exe":
-        shutil.copy(out / outname, mod.path)
+# The process started by run_target, if it's still running.
+RUNNING: Optional[subprocess.Popen] = None
+
+
+def run_target(mod: Module):
+    """Starts mod's executable, stopping the one started before it."""
+    global RUNNING
+    if RUNNING is not None and RUNNING.poll() is None:
+        RUNNING.terminate()
+        RUNNING.wait()
+
+    RUNNING = subprocess.Popen([str((mod.path / mod.module_name()).resolve())])
+
+
+def export(root: Module, out: pathlib.Path):
+    """Writes an amalgamation of every module in the project to its own
+    directory in out, named after the module. See write_amalgamation."""
+    for mod in [root] + [root.get_submodule(name) for name in root.submodules]:
+        if not (mod.has_lib or mod.has_executable):
+            continue
+        for file in write_amalgamation(mod, out / mod.module_name()):
+            if args.verbose:
+                print(f"writing {file}")
 
 
 def main():
@@ -527,27 +2718,45 @@ def main():
     if not cmod.exists():
         error("current folder is not a module")
 
-    root = Module.from_directory(pathlib.Path("."))
-    if len(args.modules) != 0:
-        for module in args.modules:
-            if module == ".":
-                if not root.has_executable:
-                    error(f"no executable to build for module '{module}'")
-                build(root, "exe")
-                return
-
-            if module not in root.submodules:
-                error(f"no submodule named '{module}' exists")
-
-            mod = root.get_submodule(module)
-            if not mod.has_executable:
-                error(f"no executable to build for module '{module}'")
-            build(root.get_submodule(module), "exe")
+    root = load_project()
+    if args.export is not None:
+        export(root, args.export)
         return
 
-    if not root.has_executable:
-        error(f"no executable to build for module '{module}'")
-    build(root, "exe")
+    targets = select_targets(root)
+    if args.run and len(targets) != 1:
+        error("--run needs exactly one module to build")
+
+    if not args.watch:
+        build(targets)
+        if args.run:
+            run_target(targets[0])
+            exit(RUNNING.wait())
+        return
+
+    try:
+        build(targets)
+        if args.run:
+            run_target(targets[0])
+    except SystemExit:
+        pass
+
+    try:
+        watch(root, targets)
+    except KeyboardInterrupt:
+        if RUNNING is not None and RUNNING.poll() is None:
+            RUNNING.terminate()
+
+
+def positive_int(value: str) -> int:
+    """Parses a command line argument which has to be a number above 0."""
+    try:
+        n = int(value)
+    except ValueError:
+        n = 0
+    if n <= 0:
+        raise argparse.ArgumentTypeError(f"'{value}' isn't a number above 0")
+    return n
 
 
 if __name__ == "__main__":
@@ -558,10 +2767,92 @@ if __name__ == "__main__":
         type=str,
         nargs="*",
         help="the module or modules to build. Tries to build the module in the "
-        + "current directory if no arguments are given.",
+        + "current directory if no arguments are given. './...' builds every "
+        + "executable in the project.",
     )
     argparser.add_argument(
         "-v", "--verbose", action="store_true", help="enables verbose output."
     )
+    argparser.add_argument(
+        "-j",
+        "--jobs",
+        metavar="N",
+        type=positive_int,
+        default=os.cpu_count() or 1,
+        help="the number of compile jobs to run at once. Defaults to the "
+        + "number of processors.",
+    )
+    argparser.add_argument(
+        "--fetch-jobs",
+        metavar="N",
+        type=positive_int,
+        default=8,
+        help="the number of repositories to download at once. Defaults to 8.",
+    )
+    argparser.add_argument(
+        "--profile",
+        metavar="NAME",
+        default="debug",
+        help="the profile to build with: 'debug', 'release', 'release-lto' or "
+        + "one declared in c.mod. Defaults to 'debug'.",
+    )
+    argparser.add_argument(
+        "--stats",
+        action="store_true",
+        help="prints a summary of build cache hits and misses.",
+    )
+    argparser.add_argument(
+        "--no-pch",
+        dest="pch",
+        action="store_false",
+        help="doesn't precompile the headers each module's translation units "
+        + "start with.",
+    )
+    argparser.add_argument(
+        "--unity",
+        action="store_true",
+        help="compiles each executable, along with everything it imports, as "
+        + "a single translation unit.",
+    )
+    argparser.add_argument(
+        "--export",
+        metavar="DIR",
+        type=pathlib.Path,
+        help="writes an amalgamation of each module in the project to DIR "
+        + "instead of building.",
+    )
+    argparser.add_argument(
+        "--watch",
+        action="store_true",
+        help="keeps running after the build, rebuilding whenever a file in the "
+        + "project changes.",
+    )
+    argparser.add_argument(
+        "--run",
+        action="store_true",
+        help="runs the executable after it's built. With --watch, it's "
+        + "restarted after every rebuild.",
+    )
+    argparser.add_argument(
+        "--trace",
+        metavar="FILE",
+        type=pathlib.Path,
+        help="writes a timeline of the build to FILE in the Chrome trace event "
+        + "format, which can be viewed in chrome://tracing or Perfetto.",
+    )
     args = argparser.parse_args()
-    main()
+    TRACE.enabled = args.trace is not None
+    if C_REMOTE_CACHE is not None:
+        REMOTE = cache_backend(C_REMOTE_CACHE)
+    try:
+        main()
+    finally:
+        # Written even if the build failed, since that's often when they're
+        # wanted.
+        if args.trace is not None:
+            TRACE.save(args.trace)
+        if args.stats:
+            hits = f"{STATS.hits} hits"
+            if C_REMOTE_CACHE is not None:
+                hits += f" ({STATS.remote_hits} remote)"
+            print(f"cache: {hits}, {STATS.misses} misses")
@@ -0,0 +1,2117 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "c.eldidi.org/c/modfile"
+#include "c.eldidi.org/c/util"
+#include "c.eldidi.org/x/arena"
+#include "c.eldidi.org/x/containers"
+#include "c.eldidi.org/x/fs"
+#include "c.eldidi.org/x/hash"
+#include "c.eldidi.org/x/process"
+#include "c.eldidi.org/x/str"
+
+// The C implementation of the `cbuild` command. It produces the same build
+// directory layout and outputs as cbuild.py, but decides what to rebuild by
+// comparing modification times instead of hashing, so a build where nothing
+// changed only has to stat its inputs.
+
+typedef StrSlice Strs;
+
+// Map is a hash trie from strings to pointers, in the same style as
+// CPlatformFlags.
+typedef struct Map Map;
+struct Map {
+	Map*  child[4];
+	char* key;
+	void* value;
+};
+
+// map_get returns a pointer to the value for k in map. If k isn't in the
+// map, it is added when mem isn't NULL, and NULL is returned otherwise.
+static void**
+map_get(Arena* mem, Map** map, char* k)
+{
+	assert(map != NULL);
+	for (uint64_t h = fnv_1a_str(k); *map; h <<= 2) {
+		if (strcmp(k, (*map)->key) == 0) {
+			return &(*map)->value;
+		}
+		map = &(*map)->child[h >> 62];
+	}
+
+	if (mem == NULL) {
+		return NULL;
+	}
+
+	*map        = arena_make(mem, Map);
+	(*map)->key = k;
+	return &(*map)->value;
+}
+
+typedef struct Module Module;
+struct Module {
+	char* import_path;
+	char* name;
+	// The path containing the sources for the module.
+	char* path;
+	// Where the preprocessed sources and outputs go.
+	char*   build_dir;
+	char*   std;
+	bool    has_executable;
+	bool    has_lib;
+	Module* parent;
+	// The flags from c.mod for the current OS, or NULL.
+	CFlags* platform_flags;
+	// The profiles declared in c.mod, indexed by name.
+	CPlatformFlags profiles;
+	// The names of each submodule.
+	Strs submodules;
+	// The import paths of the modules this module imports directly.
+	Strs dependencies;
+	bool preprocessed;
+	// The generated __module.h, once it has been generated.
+	char* header;
+};
+
+// LockEntry is where a remote import was resolved to. See the `c.sum`
+// section of doc/cbuild.md.
+typedef struct LockEntry {
+	char* root;
+	char* url;
+	char* commit;
+	bool  used;
+} LockEntry;
+
+typedef struct Job  Job;
+typedef struct Jobs Jobs;
+struct Jobs {
+	Job**  data;
+	size_t len;
+	size_t cap;
+};
+
+enum {
+	JOB_WAITING,
+	JOB_RUNNING,
+	JOB_DONE,
+};
+
+// Job is a single compiler invocation in the build graph.
+struct Job {
+	char* description;
+	Strs  argv;
+	char* output;
+	// The files the output is built from.
+	Strs inputs;
+	Jobs deps;
+	// Where to copy the output once it is built, or NULL.
+	char* install;
+	// Where the compiler writes the files it read, or NULL. When set, the
+	// files listed in it are the job's inputs.
+	char*   depfile;
+	int     state;
+	Process process;
+};
+
+// Profile is a set of flags to build with, selected with --profile.
+typedef struct Profile {
+	char* name;
+	Strs  compile_flags;
+	Strs  link_flags;
+} Profile;
+
+typedef struct Cbuild {
+	Arena* mem;
+	Arena  scratch;
+	bool   verbose;
+	bool   stats;
+	long   jobs;
+	char*  clang;
+	char*  ar;
+	char*  git;
+	char*  os;
+	char*  build_dir;
+	char*  download_dir;
+	char*  cache_dir;
+	// What toolchain_find found out about clang.
+	Toolchain toolchain;
+	// Where the outputs of the profile being built with go.
+	char*   output_dir;
+	Profile profile;
+	// Every module loaded so far, indexed by import path.
+	Map* modules;
+	// The entries of c.sum, indexed by import path.
+	Map* lock;
+	Strs lock_keys;
+	bool lock_dirty;
+	// Every job in the graph, indexed by output.
+	Map*   jobs_by_output;
+	Jobs   graph;
+	size_t hits;
+	size_t misses;
+} Cbuild;
+
+// The flags every translation unit is compiled with, whatever the profile.
+// Kept in sync with COMPILE_FLAGS in cbuild.py.
+static char* compile_flags[] = {
+		"-Wall",
+		"-Wextra",
+		"-Werror=conversion",
+		"-Werror=shadow",
+		"-Wno-sign-conversion", // so uint - 1 doesn't warn of conversion
+		"-fasynchronous-unwind-tables", // so _Unwind_* always works.
+		"-Werror=format-security",
+		"-Werror=implicit-function-declaration",
+		// Puts each function and variable in its own section, so the
+		// linker can drop the ones nothing uses.
+		"-ffunction-sections",
+		"-fdata-sections",
+};
+
+static char*
+get_os()
+{
+#if defined(__APPLE__)
+	return "macos";
+#elif defined(_WIN32)
+	return "windows";
+#elif defined(__FreeBSD__)
+	return "freebsd";
+#else
+	return "linux";
+#endif
+}
+
+static bool
+has_prefix(char* s, char* prefix)
+{
+	return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+static bool
+strs_contains(Strs* s, char* str)
+{
+	for (size_t i = 0; i < s->len; i += 1) {
+		if (strcmp(s->data[i], str) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// strs_push_unique pushes str unless s already contains it.
+static void
+strs_push_unique(Arena* mem, Strs* s, char* str)
+{
+	if (!strs_contains(s, str)) {
+		*slice_push(mem, s) = str;
+	}
+}
+
+static int
+compare_strs(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void
+sort_strs(Strs* s)
+{
+	// qsort mustn't be passed NULL, even for an empty array.
+	if (s->len != 0) {
+		qsort(s->data, s->len, sizeof(char*), compare_strs);
+	}
+}
+
+static bool
+is_file(char* path)
+{
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static Bytes
+read_file(Arena* mem, char* path)
+{
+	Bytes result = {.ok = false};
+	FILE* f      = fopen(path, "rb");
+	if (f == NULL) {
+		return result;
+	}
+
+	result = readfull(mem, f);
+	fclose(f);
+	return result;
+}
+
+static void
+write_file(char* path, char* data, size_t len, int mode)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+	if (fd < 0) {
+		fatal("couldn't open '%s' for writing", path);
+	}
+
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0) {
+			fatal("couldn't write to '%s'", path);
+		}
+		data += n;
+		len -= (size_t)n;
+	}
+	close(fd);
+}
+
+// write_if_changed writes data to path unless it already contains exactly
+// that, so the file's modification time only changes with its contents.
+// Returns whether the file was written.
+static bool
+write_if_changed(Arena scratch, char* path, char* data, size_t len)
+{
+	Bytes old = read_file(&scratch, path);
+	if (old.ok && old.len == len && memcmp(old.data, data, len) == 0) {
+		return false;
+	}
+
+	write_file(path, data, len, 0644);
+	return true;
+}
+
+// copy_to_dir copies the file at path into dir, unless the copy there is
+// already up to date.
+static void
+copy_to_dir(Arena scratch, char* path, char* dir)
+{
+	char* name = strrchr(path, '/');
+	name       = name == NULL ? path : name + 1;
+	char* dest = str_format(&scratch, "%s/%s", dir, name);
+	if (mtime(dest) >= mtime(path)) {
+		return;
+	}
+
+	Bytes data = read_file(&scratch, path);
+	if (!data.ok) {
+		fatal("couldn't read '%s'", path);
+	}
+	(void)unlink(dest);
+	write_file(dest, (char*)data.data, data.len, 0755);
+}
+
+// Buf is a growable byte buffer.
+typedef struct Buf {
+	char*  data;
+	size_t len;
+	size_t cap;
+} Buf;
+
+// buf_reserve makes room for n more bytes and a NULL terminator in b.
+static void
+buf_reserve(Arena* mem, Buf* b, size_t n)
+{
+	if (b->len + n + 1 <= b->cap) {
+		return;
+	}
+
+	size_t cap = b->cap == 0 ? 4096 : b->cap;
+	while (b->len + n + 1 > cap) {
+		cap *= 2;
+	}
+
+	char* new = arena_make(mem, char, cap);
+	if (b->len != 0) {
+		memcpy(new, b->data, b->len);
+	}
+	b->data = new;
+	b->cap  = cap;
+}
+
+static void
+buf_append(Arena* mem, Buf* b, char* data, size_t len)
+{
+	buf_reserve(mem, b, len);
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+	b->data[b->len] = '\0';
+}
+
+static void
+buf_format(Arena* mem, Buf* b, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+	assert(len >= 0);
+
+	buf_reserve(mem, b, (size_t)len);
+	va_start(args, format);
+	vsnprintf(b->data + b->len, (size_t)len + 1, format, args);
+	va_end(args);
+	b->len += (size_t)len;
+}
+
+// run runs argv and waits for it, returning its exit status.
+static int
+run(Cbuild* b, Strs* argv)
+{
+	if (b->verbose) {
+		for (size_t i = 0; i < argv->len; i += 1) {
+			printf("%s%s", i == 0 ? "" : " ", argv->data[i]);
+		}
+		printf("\n");
+	}
+
+	Arena  tmp  = b->scratch;
+	char** args = arena_make(&tmp, char*, argv->len + 1);
+	memcpy(args, argv->data, argv->len * sizeof(char*));
+	Process p = process_spawn(tmp, (int)argv->len, args);
+	if (p.status != 0) {
+		fatal("failed to launch '%s'", argv->data[0]);
+	}
+
+	return process_wait(p, true);
+}
+
+// run_silently runs argv with its output discarded, returning its exit
+// status.
+static int
+run_silently(char** argv)
+{
+	pid_t pid = fork();
+	if (pid < 0) {
+		return -1;
+	}
+
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	int status = 0;
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+		return -1;
+	}
+	return WEXITSTATUS(status);
+}
+
+static int
+git(Cbuild* b, char* dir, int argc, ...)
+{
+	Arena tmp  = b->scratch;
+	Strs  argv = {0};
+	*slice_push(&tmp, &argv) = b->git;
+	*slice_push(&tmp, &argv) = "-C";
+	*slice_push(&tmp, &argv) = dir;
+
+	va_list args;
+	va_start(args, argc);
+	for (int i = 0; i < argc; i += 1) {
+		*slice_push(&tmp, &argv) = va_arg(args, char*);
+	}
+	va_end(args);
+
+	Cbuild tmp_b  = *b;
+	tmp_b.scratch = tmp;
+	return run(&tmp_b, &argv);
+}
+
+// git_head returns the commit checked out in the repository at dir, or NULL
+// if there isn't one. Reads .git directly so no process has to be started.
+static char*
+git_head(Cbuild* b, char* dir)
+{
+	Arena tmp  = b->scratch;
+	Bytes head = read_file(&tmp, str_format(&tmp, "%s/.git/HEAD", dir));
+	if (!head.ok) {
+		return NULL;
+	}
+
+	char* h = (char*)head.data;
+	h[strcspn(h, "\r\n")] = '\0';
+	if (!has_prefix(h, "ref: ")) {
+		return str_format(b->mem, "%s", h);
+	}
+
+	char* ref = h + strlen("ref: ");
+	Bytes commit =
+			read_file(&tmp, str_format(&tmp, "%s/.git/%s", dir, ref));
+	if (commit.ok) {
+		char* c               = (char*)commit.data;
+		c[strcspn(c, "\r\n")] = '\0';
+		return str_format(b->mem, "%s", c);
+	}
+
+	Bytes packed = read_file(
+			&tmp, str_format(&tmp, "%s/.git/packed-refs", dir));
+	if (!packed.ok) {
+		return NULL;
+	}
+
+	StrSlice lines = str_split(&tmp, (char*)packed.data, '\n');
+	for (size_t i = 0; i < lines.len; i += 1) {
+		char* space = strchr(lines.data[i], ' ');
+		if (space == NULL || strcmp(space + 1, ref) != 0) {
+			continue;
+		}
+
+		*space = '\0';
+		return str_format(b->mem, "%s", lines.data[i]);
+	}
+
+	return NULL;
+}
+
+// git_origin returns the URL of the origin remote of the repository at dir,
+// or NULL if it has none.
+static char*
+git_origin(Cbuild* b, char* dir)
+{
+	Arena tmp    = b->scratch;
+	Bytes config = read_file(
+			&tmp, str_format(&tmp, "%s/.git/config", dir));
+	if (!config.ok) {
+		return NULL;
+	}
+
+	StrSlice lines     = str_split(&tmp, (char*)config.data, '\n');
+	bool     in_origin = false;
+	for (size_t i = 0; i < lines.len; i += 1) {
+		char* line = lines.data[i];
+		line += strspn(line, " \t");
+		if (line[0] == '[') {
+			in_origin = has_prefix(line, "[remote \"origin\"]");
+			continue;
+		}
+
+		if (!in_origin || !has_prefix(line, "url")) {
+			continue;
+		}
+
+		char* value = strchr(line, '=');
+		if (value == NULL) {
+			continue;
+		}
+		value += 1 + strspn(value + 1, " \t");
+		value[strcspn(value, "\r\n")] = '\0';
+		return str_format(b->mem, "%s", value);
+	}
+
+	return NULL;
+}
+
+static void
+lock_read(Cbuild* b, char* path)
+{
+	Arena tmp = b->scratch;
+	Bytes sum = read_file(&tmp, path);
+	if (!sum.ok) {
+		return;
+	}
+
+	StrSlice lines = str_split(b->mem, (char*)sum.data, '\n');
+	for (size_t i = 0; i < lines.len; i += 1) {
+		Arena    line_tmp = tmp;
+		StrSlice parts    = str_split(&line_tmp, lines.data[i], ' ');
+		strslice_remove_empty(&parts);
+		if (parts.len == 0) {
+			continue;
+		}
+		if (parts.len != 4) {
+			fatal("%s:%zu: syntax error", path, i + 1);
+		}
+
+		LockEntry* entry = arena_make(b->mem, LockEntry);
+		entry->root      = str_format(b->mem, "%s", parts.data[1]);
+		entry->url       = str_format(b->mem, "%s", parts.data[2]);
+		entry->commit    = str_format(b->mem, "%s", parts.data[3]);
+		char* key        = str_format(b->mem, "%s", parts.data[0]);
+		*map_get(b->mem, &b->lock, key) = entry;
+		*slice_push(b->mem, &b->lock_keys) = key;
+	}
+}
+
+static LockEntry*
+lock_get(Cbuild* b, char* import_path)
+{
+	void** entry = map_get(NULL, &b->lock, import_path);
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	LockEntry* result = *entry;
+	result->used      = true;
+	return result;
+}
+
+static void
+lock_set(Cbuild* b, char* import_path, LockEntry* entry)
+{
+	entry->used  = true;
+	void** value = map_get(b->mem, &b->lock, import_path);
+	if (*value == NULL) {
+		*slice_push(b->mem, &b->lock_keys) = import_path;
+	}
+	*value        = entry;
+	b->lock_dirty = true;
+}
+
+// lock_write writes c.sum, dropping the entries which are no longer used.
+static void
+lock_write(Cbuild* b, char* path)
+{
+	Arena tmp  = b->scratch;
+	Strs  keys = b->lock_keys;
+	sort_strs(&keys);
+
+	Buf text = {0};
+	for (size_t i = 0; i < keys.len; i += 1) {
+		LockEntry* entry = *map_get(NULL, &b->lock, keys.data[i]);
+		if (!entry->used) {
+			continue;
+		}
+
+		buf_format(&tmp, &text, "%s %s %s %s\n", keys.data[i],
+				entry->root, entry->url, entry->commit);
+	}
+
+	if (text.len == 0 && !is_file(path)) {
+		return;
+	}
+	(void)write_if_changed(tmp, path, text.len == 0 ? "" : text.data,
+			text.len);
+}
+
+static Module* module_from_directory(Cbuild* b, char* path);
+static void    module_preprocess(Cbuild* b, Module* mod);
+
+static Module*
+get_submodule(Cbuild* b, Module* root, char* name)
+{
+	assert(strs_contains(&root->submodules, name));
+	char*   import_path = str_format(b->mem, "%s/%s", root->import_path,
+			  name);
+	void**  cached      = map_get(b->mem, &b->modules, import_path);
+	Module* result      = *cached;
+	if (result != NULL) {
+		return result;
+	}
+
+	Arena tmp              = b->scratch;
+	result                 = arena_make(b->mem, Module);
+	*result                = *root;
+	result->parent         = root;
+	result->submodules     = (Strs){0};
+	result->dependencies   = (Strs){0};
+	result->preprocessed   = false;
+	result->header         = NULL;
+	result->name           = str_format(b->mem, "%s", name);
+	result->path           = str_format(b->mem, "%s/%s", root->path, name);
+	result->import_path    = import_path;
+	result->build_dir      = str_format(b->mem, "%s/%s", b->build_dir,
+			     import_path);
+	result->has_executable = is_file(
+			str_format(&tmp, "%s/main.c", result->path));
+	result->has_lib =
+			is_file(str_format(&tmp, "%s/lib.c", result->path)) ||
+			is_file(str_format(&tmp, "%s/%s.c", result->path,
+					name));
+	*cached = result;
+	return result;
+}
+
+// tool_module returns the module for the tool called name in root's tools
+// directory, which is either the single file tools/<name>.c or a directory
+// tools/<name>/ laid out like any submodule. It's built like a submodule of
+// root, and preprocessed before it's returned.
+static Module*
+tool_module(Cbuild* b, Module* root, char* name)
+{
+	if (*name == '\0' || *name == '.' || strchr(name, '/') != NULL) {
+		fatal("invalid tool name '%s'", name);
+	}
+
+	Arena tmp  = b->scratch;
+	char* path = str_format(b->mem, "%s/tools/%s", root->path, name);
+	if (!is_file(str_format(&tmp, "%s/main.c", path))) {
+		char* file = str_format(&tmp, "%s.c", path);
+		if (!is_file(file)) {
+			fatal("no tool named '%s' exists", name);
+		}
+
+		// A single file gets a directory of its own to be preprocessed
+		// from, which is only written when the file changes.
+		path = str_format(b->mem, "%s/%s/.tools/%s", b->build_dir,
+				root->import_path, name);
+		if (!make_dirs(tmp, path)) {
+			fatal("couldn't create directory '%s'", path);
+		}
+		Bytes data = read_file(&tmp, file);
+		if (!data.ok) {
+			fatal("couldn't read '%s'", file);
+		}
+		(void)write_if_changed(tmp, str_format(&tmp, "%s/main.c", path),
+				(char*)data.data, data.len);
+	}
+
+	char*   import_path    = str_format(
+			b->mem, "%s/tools/%s", root->import_path, name);
+	void**  cached         = map_get(b->mem, &b->modules, import_path);
+	Module* result         = arena_make(b->mem, Module);
+	*result                = *root;
+	result->parent         = root;
+	result->submodules     = (Strs){0};
+	result->dependencies   = (Strs){0};
+	result->preprocessed   = false;
+	result->header         = NULL;
+	result->name           = name;
+	result->path           = path;
+	result->import_path    = import_path;
+	result->build_dir      = str_format(b->mem, "%s/%s", b->build_dir,
+			     import_path);
+	result->has_executable = true;
+	result->has_lib =
+			is_file(str_format(&tmp, "%s/lib.c", path)) ||
+			is_file(str_format(&tmp, "%s/%s.c", path, name));
+	*cached = result;
+	module_preprocess(b, result);
+	return result;
+}
+
+// downloaded_root returns the import path of the downloaded repository
+// containing import_path, or NULL if it wasn't downloaded.
+static char*
+downloaded_root(Cbuild* b, char* import_path)
+{
+	Arena tmp = b->scratch;
+	if (!is_dir(str_format(&tmp, "%s/%s", b->download_dir,
+			    import_path))) {
+		return NULL;
+	}
+
+	char* root = str_format(b->mem, "%s", import_path);
+	while (!is_file(str_format(
+			&tmp, "%s/%s/c.mod", b->download_dir, root))) {
+		char* slash = strrchr(root, '/');
+		if (slash == NULL) {
+			return NULL;
+		}
+		*slash = '\0';
+	}
+
+	return root;
+}
+
+// fetch_repository downloads the repository described by entry, checking out
+// entry->commit if it is set and the main branch otherwise. Returns whether
+// it succeeded.
+static bool
+fetch_repository(Cbuild* b, LockEntry* entry)
+{
+	char* dir = str_format(b->mem, "%s/%s", b->download_dir, entry->root);
+	if (!make_dirs(b->scratch, dir)) {
+		fatal("couldn't create directory '%s'", dir);
+	}
+
+	// We do `git init; git remote add url git fetch; git checkout;`
+	// instead of `git clone folder url` in case the folder is not
+	// empty, which git doesn't allow.
+	Arena tmp = b->scratch;
+	if (!is_dir(str_format(&tmp, "%s/.git", dir))) {
+		if (git(b, dir, 1, "init") != 0 ||
+				git(b, dir, 4, "remote", "add", "origin",
+						entry->url) != 0) {
+			return false;
+		}
+	} else if (git(b, dir, 4, "remote", "set-url", "origin",
+				   entry->url) != 0) {
+		return false;
+	}
+
+	if (entry->commit != NULL) {
+		return git(b, dir, 4, "fetch", "--depth=1", "origin",
+				       entry->commit) == 0 &&
+		       git(b, dir, 3, "checkout", "--detach",
+				       entry->commit) == 0;
+	}
+
+	if (git(b, dir, 2, "fetch", "--depth=1") != 0 ||
+			git(b, dir, 2, "checkout", "main") != 0) {
+		return false;
+	}
+
+	entry->commit = git_head(b, dir);
+	return entry->commit != NULL;
+}
+
+// probe_repository finds the repository containing import_path by asking git
+// about each of its prefixes in turn, longest first.
+static LockEntry*
+probe_repository(Cbuild* b, char* import_path)
+{
+	char* remote_url = getenv("C_REMOTE_URL");
+	if (remote_url == NULL) {
+		remote_url = "https://";
+	}
+
+	char* current = str_format(b->mem, "%s", import_path);
+	while (true) {
+		char* url    = str_format(b->mem, "%s%s", remote_url, current);
+		char* argv[] = {b->git, "ls-remote", "--exit-code", url, "HEAD",
+				NULL};
+		if (b->verbose) {
+			printf("probing %s\n", url);
+		}
+		if (run_silently(argv) == 0) {
+			LockEntry* entry = arena_make(b->mem, LockEntry);
+			entry->root      = current;
+			entry->url       = url;
+			return entry;
+		}
+
+		char* slash = strrchr(current, '/');
+		// If we've reached first part of the module name and still
+		// haven't found anything, it must not exist.
+		if (slash == NULL) {
+			fatal("no module with name %s", import_path);
+		}
+		*slash = '\0';
+	}
+}
+
+// downloaded_module returns the module for import_path, which is found in
+// the repository downloaded for root.
+static Module*
+downloaded_module(Cbuild* b, Module* importer, char* root, char* import_path)
+{
+	Arena tmp = b->scratch;
+	char* dir = str_format(b->mem, "%s/%s", b->download_dir, root);
+	if (!is_file(str_format(&tmp, "%s/c.mod", dir))) {
+		fatal("downloaded repository is not a cbuild project (no c.mod "
+		      "file found)");
+	}
+
+	Module* result = module_from_directory(b, dir);
+	if (strcmp(root, import_path) != 0) {
+		// we imported a submodule
+		char* name = import_path + strlen(root) + 1;
+		if (!strs_contains(&result->submodules, name)) {
+			fatal("module '%s' has no submodule '%s' (imported by "
+			      "%s)",
+					root, name, importer->import_path);
+		}
+		result = get_submodule(b, result, name);
+	}
+
+	return result;
+}
+
+// resolve_import resolves an import in the context of building mod.
+static Module*
+resolve_import(Cbuild* b, Module* mod, char* import_path)
+{
+	Module* root = mod->parent != NULL ? mod->parent : mod;
+	if (has_prefix(import_path, root->import_path)) {
+		// It is a submodule
+		char* name = strrchr(import_path, '/');
+		name       = name == NULL ? import_path : name + 1;
+		if (!strs_contains(&root->submodules, name)) {
+			fatal("module '%s' does not have a submodule '%s'",
+					root->import_path, name);
+		}
+
+		return get_submodule(b, root, name);
+	}
+
+	// It is a remote module. The lockfile tells us exactly which
+	// repository and commit it comes from, so we only need to go to the
+	// network if that commit isn't downloaded yet.
+	LockEntry* entry = lock_get(b, import_path);
+	if (entry != NULL) {
+		// git_head uses the scratch arena itself, so dir can't be on
+		// it.
+		char* dir  = str_format(b->mem, "%s/%s", b->download_dir,
+				 entry->root);
+		char* head = git_head(b, dir);
+		if (head == NULL || strcmp(head, entry->commit) != 0) {
+			printf("downloading module %s...\n", import_path);
+			if (!fetch_repository(b, entry)) {
+				fatal("failed to fetch module '%s' (imported "
+				      "by '%s')",
+						entry->root, mod->import_path);
+			}
+		}
+		return downloaded_module(b, mod, entry->root, import_path);
+	}
+
+	// If it was fetched by a previous build, record it in the lockfile
+	// as-is.
+	char* root_path = downloaded_root(b, import_path);
+	if (root_path != NULL) {
+		char* dir = str_format(b->mem, "%s/%s", b->download_dir,
+				root_path);
+		entry     = arena_make(b->mem, LockEntry);
+		entry->root   = root_path;
+		entry->url    = git_origin(b, dir);
+		entry->commit = git_head(b, dir);
+		if (entry->url != NULL && entry->commit != NULL) {
+			lock_set(b, import_path, entry);
+			return downloaded_module(
+					b, mod, root_path, import_path);
+		}
+	}
+
+	printf("downloading module %s...\n", import_path);
+	entry = probe_repository(b, import_path);
+	if (!fetch_repository(b, entry)) {
+		fatal("failed to fetch module '%s' (imported by '%s')",
+				entry->root, mod->import_path);
+	}
+	lock_set(b, import_path, entry);
+	return downloaded_module(b, mod, entry->root, import_path);
+}
+
+// What separates the words of an #include, like str.split() in cbuild.py
+// and the tokens of a c.mod file.
+static const char* const blanks = " \t\v\f\r";
+
+// parse_import returns the import path if line is an #include which imports
+// a module, and NULL otherwise. The line is modified.
+static char*
+parse_import(char* line)
+{
+	char*  directive = line + strspn(line, blanks);
+	size_t len       = strcspn(directive, blanks);
+	if (len != strlen("#include") ||
+			strncmp(directive, "#include", len) != 0) {
+		return NULL;
+	}
+	char* include = directive + len + strspn(directive + len, blanks);
+	if (*include == '\0') {
+		return NULL;
+	}
+	include[strcspn(include, blanks)] = '\0';
+
+	// is it a system include?
+	if (include[0] == '<') {
+		return NULL;
+	}
+
+	include += strspn(include, "\"");
+	include[strcspn(include, "\"")] = '\0';
+	if (has_prefix(include, "./") || has_prefix(include, "../")) {
+		return NULL;
+	}
+
+	return include;
+}
+
+// relative_path returns the path to path from the directory dir, where both
+// are relative to the same directory and have no '.' or '..' components, like
+// os.path.relpath in cbuild.py.
+static char*
+relative_path(Arena* mem, char* path, char* dir)
+{
+	// The length of the directories they have in common, with the slash
+	// after them.
+	size_t common = 0;
+	size_t len    = strlen(dir);
+	if (strncmp(path, dir, len) == 0 && path[len] == '/') {
+		common = len + 1;
+	} else {
+		for (size_t i = 0; dir[i] == path[i]; i += 1) {
+			if (dir[i] == '/') {
+				common = i + 1;
+			}
+		}
+	}
+
+	// Then one step up for each of dir's directories which path isn't in.
+	Buf result = {0};
+	if (common <= len) {
+		buf_append(mem, &result, "../", 3);
+		for (char* c = dir + common; *c != '\0'; c += 1) {
+			if (*c == '/') {
+				buf_append(mem, &result, "../", 3);
+			}
+		}
+	}
+	buf_format(mem, &result, "%s", path + common);
+	return result.data;
+}
+
+// module_preprocess rewrites the imports in each of mod's files, putting the
+// result in its build directory. Files are only written if their contents
+// changed.
+static void
+module_preprocess(Cbuild* b, Module* mod)
+{
+	if (mod->preprocessed) {
+		return;
+	}
+	mod->preprocessed = true;
+	if (b->verbose) {
+		printf("preprocessing module '%s'\n", mod->import_path);
+	}
+
+	if (!make_dirs(b->scratch, mod->build_dir)) {
+		fatal("couldn't create directory '%s'", mod->build_dir);
+	}
+	Strs files   = list_dir(b->mem, mod->path);
+	Strs sources = {0};
+	for (size_t i = 0; i < files.len; i += 1) {
+		Arena tmp  = b->scratch;
+		char* name = files.data[i];
+		char* file = str_format(&tmp, "%s/%s", mod->path, name);
+		if (!(has_suffix(name, ".c") || has_suffix(name, ".h")) ||
+				!is_file(file)) {
+			continue;
+		}
+		*slice_push(b->mem, &sources) = name;
+
+		Bytes data = file_map(&tmp, file);
+		if (!data.ok) {
+			fatal("couldn't read '%s'", file);
+		}
+
+		// Mirrors Python's str.splitlines(): a trailing newline doesn't
+		// start another line.
+		char* text = (char*)data.data;
+		char* end  = text + data.len;
+		if (end > text && end[-1] == '\n') {
+			end -= 1;
+		}
+
+		Buf out = {0};
+		buf_format(&tmp, &out, "#line 1 \"%s/%s\"",
+				mod->import_path, name);
+		// Lines are scanned where they are in the file, and only the
+		// ones which could be an #include are copied to be parsed.
+		for (char* line = text; line < end;) {
+			char* next = memchr(line, '\n', (size_t)(end - line));
+			if (next == NULL) {
+				next = end;
+			}
+			size_t line_len = (size_t)(next - line);
+			if (line_len > 0 && line[line_len - 1] == '\r') {
+				line_len -= 1;
+			}
+
+			Arena line_tmp  = tmp;
+			char* include   = NULL;
+			char* directive = line + strspn(line, blanks);
+			if (directive < next && *directive == '#') {
+				include = parse_import(str_format(&line_tmp,
+						"%.*s", (int)line_len, line));
+			}
+			char* current = line;
+			line          = next + 1;
+			if (include == NULL) {
+				buf_append(&tmp, &out, "\n", 1);
+				buf_append(&tmp, &out, current, line_len);
+				continue;
+			}
+
+			// Resolving may load other modules, which must not
+			// clobber what this file has on the scratch arena.
+			Arena saved      = b->scratch;
+			b->scratch       = tmp;
+			Module* imported = resolve_import(
+					b, mod, str_format(b->mem, "%s",
+							     include));
+			b->scratch = saved;
+			if (strcmp(imported->import_path, mod->import_path) ==
+					0) {
+				fatal("module '%s' includes itself, which is "
+				      "not allowed.",
+						mod->import_path);
+			}
+			strs_push_unique(b->mem, &mod->dependencies,
+					imported->import_path);
+			// The same relative path cbuild.py writes.
+			char* header = str_format(&line_tmp, "%s/__module.h",
+					imported->import_path);
+			buf_format(&tmp, &out, "\n#include \"%s\"",
+					relative_path(&line_tmp, header,
+							mod->import_path));
+		}
+		file_unmap(data);
+
+		char* output = str_format(&tmp, "%s/%s", mod->build_dir, name);
+		if (write_if_changed(tmp, output, out.data, out.len) &&
+				b->verbose) {
+			printf("writing include %s\n", output);
+		}
+	}
+
+	// The build directory persists between runs, so files which were
+	// deleted from the module must be removed from it too, otherwise
+	// they'd still end up in __module.h.
+	Arena tmp     = b->scratch;
+	Strs  outputs = list_dir(&tmp, mod->build_dir);
+	for (size_t i = 0; i < outputs.len; i += 1) {
+		char* name = outputs.data[i];
+		if (!(has_suffix(name, ".c") || has_suffix(name, ".h")) ||
+				strcmp(name, "__module.h") == 0 ||
+				strs_contains(&sources, name)) {
+			continue;
+		}
+
+		char* file = str_format(&tmp, "%s/%s", mod->build_dir, name);
+		if (b->verbose) {
+			printf("removing stale file %s\n", file);
+		}
+		(void)unlink(file);
+	}
+}
+
+typedef struct FindSubmodulesArg {
+	Cbuild* b;
+	Module* mod;
+} FindSubmodulesArg;
+
+static bool
+find_submodules_fn(char* name, void* arg)
+{
+	FindSubmodulesArg* fs  = arg;
+	Cbuild*            b   = fs->b;
+	Arena              tmp = b->scratch;
+	char* dir = str_format(&tmp, "%s/%s", fs->mod->path, name);
+	if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || !is_dir(dir)) {
+		return true;
+	}
+
+	bool has_main = is_file(str_format(&tmp, "%s/main.c", dir));
+	bool has_lib  = is_file(str_format(&tmp, "%s/lib.c", dir));
+	bool has_modc = is_file(str_format(&tmp, "%s/%s.c", dir, name));
+	if (!(has_main || has_lib || has_modc)) {
+		return true;
+	}
+
+	if (has_lib && has_modc) {
+		fatal("%s: a module can only have 1 library main file: either "
+		      "lib.c or a file of the same name as the module",
+				fs->mod->import_path);
+	}
+
+	*slice_push(b->mem, &fs->mod->submodules) =
+			str_format(b->mem, "%s", name);
+	return true;
+}
+
+// module_from_directory returns the module in path, which must contain a
+// c.mod file, preprocessing it and its submodules.
+static Module*
+module_from_directory(Cbuild* b, char* path)
+{
+	Arena tmp      = b->scratch;
+	char* cmod     = str_format(b->mem, "%s/c.mod", path);
+	CModfile modfile = modfile_parse(b->mem, cmod);
+	if (modfile.status < 0) {
+		fatal("couldn't read '%s'", cmod);
+	} else if (modfile.status > 0) {
+		fatal("%s:%" PRId64 ":%" PRId64 ": %s", cmod, modfile.status,
+				modfile.column, modfile.error);
+	}
+	if (modfile.import_path == NULL) {
+		fatal("%s: no module directive specified", cmod);
+	}
+
+	void**  cached = map_get(b->mem, &b->modules, modfile.import_path);
+	Module* result = *cached;
+	if (result != NULL) {
+		return result;
+	}
+
+	result              = arena_make(b->mem, Module);
+	result->import_path = modfile.import_path;
+	char* name          = strrchr(modfile.import_path, '/');
+	result->name        = name == NULL ? modfile.import_path : name + 1;
+	result->path        = str_format(b->mem, "%s", path);
+	result->build_dir   = str_format(b->mem, "%s/%s", b->build_dir,
+			  modfile.import_path);
+	result->std         = modfile.version;
+	result->profiles    = modfile.profiles;
+	result->has_executable = is_file(str_format(&tmp, "%s/main.c", path));
+	bool has_lib  = is_file(str_format(&tmp, "%s/lib.c", path));
+	bool has_modc = is_file(
+			str_format(&tmp, "%s/%s.c", path, result->name));
+	if (has_lib && has_modc) {
+		fatal("%s: a module can only have 1 library main file: either "
+		      "lib.c or a file of the same name as the module",
+				result->import_path);
+	}
+	result->has_lib = has_lib || has_modc;
+
+	CPlatformFlags* flags  = &modfile.platform_flags;
+	result->platform_flags = CPlatformFlags_get(NULL, &flags, b->os);
+	*cached                = result;
+
+	FindSubmodulesArg fs = {.b = b, .mod = result};
+	(void)fs_foreach_file(path, find_submodules_fn, &fs);
+	sort_strs(&result->submodules);
+
+	module_preprocess(b, result);
+	for (size_t i = 0; i < result->submodules.len; i += 1) {
+		module_preprocess(b,
+				get_submodule(b, result,
+						result->submodules.data[i]));
+	}
+	return result;
+}
+
+// module_h generates the __module.h file for mod, which includes each of its
+// headers.
+static char*
+module_h(Cbuild* b, Module* mod)
+{
+	if (mod->header != NULL) {
+		return mod->header;
+	}
+
+	Arena tmp   = b->scratch;
+	Strs  files = list_dir(&tmp, mod->build_dir);
+	Buf   text  = {0};
+	for (size_t i = 0; i < files.len; i += 1) {
+		char* name = files.data[i];
+		if (!has_suffix(name, ".h") || strcmp(name, "__module.h") == 0) {
+			continue;
+		}
+
+		buf_format(&tmp, &text, "#include \"%s\"\n", name);
+	}
+	buf_append(&tmp, &text, "\n", 1);
+
+	mod->header = str_format(b->mem, "%s/__module.h", mod->build_dir);
+	(void)write_if_changed(tmp, mod->header, text.data, text.len);
+	return mod->header;
+}
+
+static char*
+module_lib_c(Cbuild* b, Module* mod)
+{
+	assert(mod->has_lib);
+	char* lib_c = str_format(b->mem, "%s/lib.c", mod->build_dir);
+	if (is_file(lib_c)) {
+		return lib_c;
+	}
+
+	return str_format(b->mem, "%s/%s.c", mod->build_dir, mod->name);
+}
+
+// module_output_dir returns where mod's outputs go. Each profile has its own,
+// so switching between them doesn't throw any outputs away.
+static char*
+module_output_dir(Cbuild* b, Module* mod)
+{
+	char* dir = str_format(b->mem, "%s/%s", b->output_dir, mod->import_path);
+	if (!make_dirs(b->scratch, dir)) {
+		fatal("couldn't create directory '%s'", dir);
+	}
+	return dir;
+}
+
+static int
+compare_modules(const void* a, const void* b)
+{
+	Module* const* ma = a;
+	Module* const* mb = b;
+	return strcmp((*ma)->import_path, (*mb)->import_path);
+}
+
+typedef struct Modules {
+	Module** data;
+	size_t   len;
+	size_t   cap;
+} Modules;
+
+// transitive_dependencies returns every module mod depends on, directly or
+// not, sorted by import path so the commands built from it are the same on
+// every run.
+static Modules
+transitive_dependencies(Cbuild* b, Module* mod)
+{
+	Modules result = {0};
+	Map*    seen   = NULL;
+	Strs    stack  = {0};
+	for (size_t i = 0; i < mod->dependencies.len; i += 1) {
+		*slice_push(b->mem, &stack) = mod->dependencies.data[i];
+	}
+
+	while (stack.len != 0) {
+		char*  dep    = stack.data[--stack.len];
+		void** marker = map_get(b->mem, &seen, dep);
+		if (*marker != NULL || strcmp(dep, mod->import_path) == 0) {
+			continue;
+		}
+		*marker = dep;
+
+		Module* dep_mod = *map_get(NULL, &b->modules, dep);
+		*slice_push(b->mem, &result) = dep_mod;
+		for (size_t i = 0; i < dep_mod->dependencies.len; i += 1) {
+			*slice_push(b->mem, &stack) = dep_mod->dependencies.data[i];
+		}
+	}
+
+	if (result.len != 0) {
+		qsort(result.data, result.len, sizeof(Module*),
+				compare_modules);
+	}
+	return result;
+}
+
+// is_link_flag returns whether a flag from c.mod is only meaningful when
+// linking.
+static bool
+is_link_flag(char* flag)
+{
+	return has_prefix(flag, "-l") || has_prefix(flag, "-L") ||
+	       has_prefix(flag, "-Wl,");
+}
+
+static void
+push_platform_flags(Cbuild* b, Strs* argv, Module* mod, bool link)
+{
+	if (mod->platform_flags == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < mod->platform_flags->len; i += 1) {
+		char* flag = mod->platform_flags->data[i];
+		if (is_link_flag(flag) == link) {
+			strs_push_unique(b->mem, argv, flag);
+		}
+	}
+}
+
+// compiler_is_clang returns whether the compiler is clang, as opposed to gcc.
+static bool
+compiler_is_clang(Cbuild* b)
+{
+	return strstr(b->toolchain.version, "clang") != NULL;
+}
+
+static void
+push_flags(Arena* mem, Strs* s, char** flags, size_t len)
+{
+	for (size_t i = 0; i < len; i += 1) {
+		*slice_push(mem, s) = flags[i];
+	}
+}
+
+// select_profile sets the profile to build with to the one called name,
+// adding the flags root's c.mod declares for it. Kept in sync with
+// builtin_profile in cbuild.py.
+static void
+select_profile(Cbuild* b, Module* root, char* name)
+{
+	static char* sanitizers[] = {"-fsanitize=address,undefined"};
+	static char* debug[]      = {
+			"-fsanitize=address,undefined",
+			"-g3",
+			// Split DWARF keeps the debug info out of the objects, so
+			// there's less for the linker to read and copy.
+			"-gsplit-dwarf",
+	};
+	static char* release[] = {"-O2", "-DNDEBUG"};
+
+	Profile* p = &b->profile;
+	p->name    = name;
+	if (strcmp(name, "debug") == 0) {
+		push_flags(b->mem, &p->compile_flags, debug,
+				sizeof(debug) / sizeof(char*));
+		push_flags(b->mem, &p->link_flags, sanitizers,
+				sizeof(sanitizers) / sizeof(char*));
+	} else if (strcmp(name, "release") == 0) {
+		push_flags(b->mem, &p->compile_flags, release,
+				sizeof(release) / sizeof(char*));
+	} else if (strcmp(name, "release-lto") == 0) {
+		push_flags(b->mem, &p->compile_flags, release,
+				sizeof(release) / sizeof(char*));
+		push_flags(b->mem, &p->link_flags, release,
+				sizeof(release) / sizeof(char*));
+		if (!compiler_is_clang(b)) {
+			// gcc has no ThinLTO or LTO cache, but can at least
+			// run the link time optimization in parallel.
+			char* lto = str_format(b->mem, "-flto=%ld", b->jobs);
+			*slice_push(b->mem, &p->compile_flags) = lto;
+			*slice_push(b->mem, &p->link_flags)    = lto;
+		} else {
+			*slice_push(b->mem, &p->compile_flags) = "-flto=thin";
+			*slice_push(b->mem, &p->link_flags)    = "-flto=thin";
+			*slice_push(b->mem, &p->link_flags)    = str_format(
+					b->mem, "-flto-jobs=%ld", b->jobs);
+			if (find_in_path(b->mem, b->scratch, "ld.lld") != NULL) {
+				char* lto = str_format(
+						b->mem, "%s/c/lto", b->cache_dir);
+				if (!make_dirs(b->scratch, lto)) {
+					fatal("couldn't create directory '%s'",
+							lto);
+				}
+				*slice_push(b->mem, &p->link_flags) = "-fuse-ld=lld";
+				*slice_push(b->mem, &p->link_flags) = str_format(
+						b->mem,
+						"-Wl,--thinlto-cache-dir=%s",
+						fs_resolve(b->mem, b->scratch,
+								lto));
+			}
+		}
+	}
+
+	CPlatformFlags* profiles = &root->profiles;
+	CFlags*         flags    = CPlatformFlags_get(NULL, &profiles, name);
+	if (flags == NULL) {
+		if (strcmp(name, "debug") != 0 && strcmp(name, "release") != 0 &&
+				strcmp(name, "release-lto") != 0) {
+			fatal("no profile named '%s'", name);
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < flags->len; i += 1) {
+		char* flag = flags->data[i];
+		*slice_push(b->mem, is_link_flag(flag) ? &p->link_flags
+		                                       : &p->compile_flags) = flag;
+	}
+}
+
+static Job*
+job_add(Cbuild* b, Job* job)
+{
+	void** existing = map_get(b->mem, &b->jobs_by_output, job->output);
+	if (*existing != NULL) {
+		return *existing;
+	}
+
+	*existing                    = job;
+	*slice_push(b->mem, &b->graph) = job;
+	return job;
+}
+
+// build_path returns path relative to the build directory, which jobs are run
+// from, or path itself if it's outside of it. Kept in sync with build_path in
+// cbuild.py.
+static char*
+build_path(Cbuild* b, char* path)
+{
+	size_t len = strlen(b->build_dir);
+	if (strncmp(path, b->build_dir, len) == 0 && path[len] == '/') {
+		return path + len + 1;
+	}
+	return path;
+}
+
+static Job*
+job_compile(Cbuild* b, Module* mod, char* source, char* output)
+{
+	void** existing = map_get(NULL, &b->jobs_by_output, output);
+	if (existing != NULL) {
+		return *existing;
+	}
+
+	Modules deps = transitive_dependencies(b, mod);
+	Job*    job  = arena_make(b->mem, Job);
+	job->description =
+			str_format(b->mem, "compiling %s/%s", mod->import_path,
+					strrchr(source, '/') + 1);
+	job->output  = output;
+	job->depfile = str_format(b->mem, "%.*s.d",
+			(int)(strrchr(output, '.') - output), output);
+
+	Strs* argv = &job->argv;
+	*slice_push(b->mem, argv) = b->clang;
+	*slice_push(b->mem, argv) = "-c";
+	*slice_push(b->mem, argv) = "-o";
+	*slice_push(b->mem, argv) = build_path(b, output);
+	*slice_push(b->mem, argv) = "-MD";
+	*slice_push(b->mem, argv) = "-MF";
+	*slice_push(b->mem, argv) = build_path(b, job->depfile);
+	// Debug info names the directory the compiler ran in, which is the
+	// only absolute path left to keep out of the outputs.
+	*slice_push(b->mem, argv) = str_format(
+			b->mem, "-ffile-prefix-map=%s=.", b->build_dir);
+	if (mod->std != NULL) {
+		*slice_push(b->mem, argv) =
+				str_format(b->mem, "-std=%s", mod->std);
+	}
+	*slice_push(b->mem, argv) = str_format(b->mem, "--include=%s",
+			build_path(b, module_h(b, mod)));
+	for (size_t i = 0; i < sizeof(compile_flags) / sizeof(char*); i += 1) {
+		strs_push_unique(b->mem, argv, compile_flags[i]);
+	}
+	for (size_t i = 0; i < b->profile.compile_flags.len; i += 1) {
+		strs_push_unique(b->mem, argv, b->profile.compile_flags.data[i]);
+	}
+	strs_push_unique(b->mem, argv, build_path(b, source));
+	for (size_t i = 0; i < deps.len; i += 1) {
+		char* header = build_path(b, module_h(b, deps.data[i]));
+		strs_push_unique(b->mem, argv,
+				str_format(b->mem, "--include=%s", header));
+	}
+	push_platform_flags(b, argv, mod, false);
+	for (size_t i = 0; i < deps.len; i += 1) {
+		push_platform_flags(b, argv, deps.data[i], false);
+	}
+
+	return job_add(b, job);
+}
+
+// job_lib adds the jobs which compile mod's library to lib.o and pack it into
+// a static archive, so executables only link in what they use.
+static Job*
+job_lib(Cbuild* b, Module* mod)
+{
+	char*  dir      = module_output_dir(b, mod);
+	char*  output   = str_format(b->mem, "%s/lib%s.a", dir, mod->name);
+	void** existing = map_get(NULL, &b->jobs_by_output, output);
+	if (existing != NULL) {
+		return *existing;
+	}
+
+	Job* obj = job_compile(b, mod, module_lib_c(b, mod),
+			str_format(b->mem, "%s/lib.o", dir));
+	Job* job = arena_make(b->mem, Job);
+	job->description =
+			str_format(b->mem, "archiving %s", mod->import_path);
+	job->output                       = output;
+	*slice_push(b->mem, &job->deps)   = obj;
+	*slice_push(b->mem, &job->inputs) = obj->output;
+
+	Strs* argv                = &job->argv;
+	*slice_push(b->mem, argv) = b->ar;
+	*slice_push(b->mem, argv) = "rcs";
+	*slice_push(b->mem, argv) = build_path(b, output);
+	*slice_push(b->mem, argv) = build_path(b, obj->output);
+	return job_add(b, job);
+}
+
+static int
+compare_link_order(const void* a, const void* b)
+{
+	const size_t* ca = a;
+	const size_t* cb = b;
+	return (ca[0] < cb[0]) - (ca[0] > cb[0]);
+}
+
+// link_order returns mod and every module it depends on which has a library,
+// in the order their archives are given to the linker. The linker only takes
+// what is still undefined out of an archive, so each module has to come
+// before the ones it imports. A module depends on more modules than anything
+// it imports does, so sorting by that is enough.
+static Modules
+link_order(Cbuild* b, Module* mod)
+{
+	Modules deps = transitive_dependencies(b, mod);
+	// Pairs of a module's dependency count and its index in mods.
+	size_t* order = arena_make(b->mem, size_t, 2 * (deps.len + 1));
+	Modules mods  = {0};
+	for (size_t i = 0; i <= deps.len; i += 1) {
+		Module* dep = i == 0 ? mod : deps.data[i - 1];
+		if (!dep->has_lib) {
+			continue;
+		}
+
+		order[2 * mods.len]     = transitive_dependencies(b, dep).len;
+		order[2 * mods.len + 1] = mods.len;
+		*slice_push(b->mem, &mods) = dep;
+	}
+	if (mods.len == 0) {
+		return mods;
+	}
+
+	qsort(order, mods.len, 2 * sizeof(size_t), compare_link_order);
+	Modules result = {0};
+	for (size_t i = 0; i < mods.len; i += 1) {
+		*slice_push(b->mem, &result) = mods.data[order[2 * i + 1]];
+	}
+	return result;
+}
+
+static Job*
+job_exe(Cbuild* b, Module* mod)
+{
+	char*  dir      = module_output_dir(b, mod);
+	char*  output   = str_format(b->mem, "%s/%s", dir, mod->name);
+	void** existing = map_get(NULL, &b->jobs_by_output, output);
+	if (existing != NULL) {
+		return *existing;
+	}
+
+	Job* job         = arena_make(b->mem, Job);
+	job->description = str_format(b->mem, "linking %s", mod->import_path);
+	job->output      = output;
+	job->install     = mod->path;
+
+	*slice_push(b->mem, &job->deps) = job_compile(b, mod,
+			str_format(b->mem, "%s/main.c", mod->build_dir),
+			str_format(b->mem, "%s/main.o", dir));
+	Modules libs = link_order(b, mod);
+	for (size_t i = 0; i < libs.len; i += 1) {
+		*slice_push(b->mem, &job->deps) = job_lib(b, libs.data[i]);
+	}
+
+	Strs* argv = &job->argv;
+	*slice_push(b->mem, argv) = b->clang;
+	*slice_push(b->mem, argv) = "-o";
+	*slice_push(b->mem, argv) = build_path(b, output);
+	for (size_t i = 0; i < b->profile.link_flags.len; i += 1) {
+		strs_push_unique(b->mem, argv, b->profile.link_flags.data[i]);
+	}
+#if defined(__APPLE__)
+	strs_push_unique(b->mem, argv, "-Wl,-dead_strip");
+#else
+	strs_push_unique(b->mem, argv, "-Wl,--gc-sections");
+#endif
+	for (size_t i = 0; i < job->deps.len; i += 1) {
+		strs_push_unique(b->mem, argv,
+				build_path(b, job->deps.data[i]->output));
+		*slice_push(b->mem, &job->inputs) = job->deps.data[i]->output;
+	}
+	Modules deps = transitive_dependencies(b, mod);
+	push_platform_flags(b, argv, mod, true);
+	for (size_t i = 0; i < deps.len; i += 1) {
+		push_platform_flags(b, argv, deps.data[i], true);
+	}
+
+	return job_add(b, job);
+}
+
+// job_command returns the command line the job's output was last built
+// with, which is stored next to it, along with the compiler's fingerprint.
+static char*
+job_command(Cbuild* b, Job* job)
+{
+	Buf text = {0};
+	buf_format(b->mem, &text, "%s\n", b->toolchain.fingerprint);
+	for (size_t i = 0; i < job->argv.len; i += 1) {
+		buf_append(b->mem, &text, job->argv.data[i],
+				strlen(job->argv.data[i]));
+		buf_append(b->mem, &text, "\n", 1);
+	}
+
+	return text.data;
+}
+
+// parse_depfile returns the prerequisites listed in a Makefile-style depfile
+// written by the compiler's -MD flag. ok is set to whether it could be read.
+static Strs
+parse_depfile(Arena* mem, char* path, bool* ok)
+{
+	Strs  result = {0};
+	Bytes data   = read_file(mem, path);
+	*ok          = data.ok;
+	if (!data.ok) {
+		return result;
+	}
+
+	// Skip the target, which ends at the first colon followed by
+	// whitespace.
+	char* c = (char*)data.data;
+	while (*c != '\0' && !(c[0] == ':' && (c[1] == ' ' || c[1] == '\n'))) {
+		c += 1;
+	}
+	if (*c == '\0') {
+		return result;
+	}
+	c += 1;
+
+	// Each word is unescaped in place, since it never gets longer.
+	while (true) {
+		while (*c == ' ' || *c == '\t' || *c == '\n' || *c == '\r' ||
+				(c[0] == '\\' && c[1] == '\n')) {
+			c += c[0] == '\\' ? 2 : 1;
+		}
+		if (*c == '\0') {
+			return result;
+		}
+
+		char* word = c;
+		char* out  = c;
+		while (*c != '\0' && *c != ' ' && *c != '\t' && *c != '\n' &&
+				*c != '\r' && !(c[0] == '\\' && c[1] == '\n')) {
+			if (c[0] == '\\' && c[1] == ' ') {
+				c += 1;
+			}
+			*out++ = *c++;
+		}
+
+		bool end = *c == '\0';
+		if (!end && out == c) {
+			c += 1;
+		}
+		*out                      = '\0';
+		*slice_push(mem, &result) = word;
+		if (end) {
+			return result;
+		}
+	}
+}
+
+// job_up_to_date returns whether job's output is newer than all of its
+// inputs and was built with the same command line.
+static bool
+job_up_to_date(Cbuild* b, Job* job)
+{
+	Arena   tmp    = b->scratch;
+	int64_t output = mtime(job->output);
+	if (output < 0) {
+		return false;
+	}
+
+	Strs inputs = job->inputs;
+	if (job->depfile != NULL) {
+		bool ok = false;
+		inputs  = parse_depfile(&tmp, job->depfile, &ok);
+		if (!ok) {
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < inputs.len; i += 1) {
+		// The compiler lists what it was given relative to the build
+		// directory.
+		char* path = inputs.data[i];
+		if (path[0] != '/') {
+			path = str_format(&tmp, "%s/%s", b->build_dir, path);
+		}
+		int64_t input = mtime(path);
+		if (input < 0 || input > output) {
+			return false;
+		}
+	}
+
+	char* command = job_command(b, job);
+	Bytes old     = read_file(&tmp, str_format(&tmp, "%s.cmd", job->output));
+	return old.ok && strcmp((char*)old.data, command) == 0;
+}
+
+static void
+job_finish(Cbuild* b, Job* job)
+{
+	Arena tmp     = b->scratch;
+	char* command = job_command(b, job);
+	char* cmd     = str_format(&tmp, "%s.cmd", job->output);
+	(void)write_if_changed(tmp, cmd, command, strlen(command));
+	job->state = JOB_DONE;
+	if (job->install != NULL) {
+		copy_to_dir(tmp, job->output, job->install);
+	}
+}
+
+static bool
+job_ready(Job* job)
+{
+	if (job->state != JOB_WAITING) {
+		return false;
+	}
+
+	for (size_t i = 0; i < job->deps.len; i += 1) {
+		if (job->deps.data[i]->state != JOB_DONE) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// run_jobs runs every job in the graph, up to b->jobs at once. A job is
+// started as soon as all of its dependencies are done. Returns the exit
+// status of the first job which failed, or 0.
+//
+// Jobs are run from the build directory, like in cbuild.py, so the commands
+// and what the compiler writes don't depend on where it is.
+static int
+run_jobs(Cbuild* b)
+{
+	Jobs running = {0};
+	int  failed  = 0;
+	int  cwd     = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (cwd < 0) {
+		fatal("couldn't open the current directory");
+	}
+	while (true) {
+		bool started = true;
+		while (started && failed == 0 && running.len < (size_t)b->jobs) {
+			started = false;
+			for (size_t i = 0; i < b->graph.len; i += 1) {
+				Job* job = b->graph.data[i];
+				if (!job_ready(job)) {
+					continue;
+				}
+
+				started = true;
+				if (job_up_to_date(b, job)) {
+					b->hits += 1;
+					job_finish(b, job);
+					continue;
+				}
+
+				b->misses += 1;
+				if (b->verbose) {
+					printf("%s\n", job->description);
+				}
+				Arena  tmp  = b->scratch;
+				char** argv = arena_make(
+						&tmp, char*, job->argv.len + 1);
+				memcpy(argv, job->argv.data,
+						job->argv.len * sizeof(char*));
+				if (chdir(b->build_dir) != 0) {
+					fatal("couldn't enter '%s'",
+							b->build_dir);
+				}
+				job->process = process_spawn(
+						tmp, (int)job->argv.len, argv);
+				if (fchdir(cwd) != 0) {
+					fatal("couldn't return to the "
+					      "current directory");
+				}
+				if (job->process.status != 0) {
+					fatal("failed to launch '%s'", argv[0]);
+				}
+				job->state = JOB_RUNNING;
+				*slice_push(b->mem, &running) = job;
+				break;
+			}
+		}
+
+		if (running.len == 0) {
+			break;
+		}
+
+		// Wait for the oldest job.
+		Job* job = running.data[0];
+		memmove(running.data, running.data + 1,
+				(running.len - 1) * sizeof(Job*));
+		running.len -= 1;
+		int status = process_wait(job->process, true);
+		if (status != 0) {
+			// Let the jobs which are already running finish, but
+			// don't start any new ones.
+			if (failed == 0) {
+				failed = status;
+			}
+			job->state = JOB_DONE;
+			continue;
+		}
+
+		job_finish(b, job);
+	}
+
+	close(cwd);
+	return failed;
+}
+
+// is_source returns whether a change to path can change what's built from
+// it.
+static bool
+is_source(char* path)
+{
+	char* name = strrchr(path, '/');
+	name       = name == NULL ? path : name + 1;
+	return has_suffix(name, ".c") || has_suffix(name, ".h") ||
+	       strcmp(name, "c.mod") == 0;
+}
+
+// write_inputs writes the manifest crun checks to run mod's executable
+// without building first. It holds the toolchain's fingerprint and the
+// modification time of every file and directory the executable was built
+// from, along with the installed executable itself. If a source file changed
+// after started, the build may not have seen the change, so no manifest is
+// written and crun builds again. Kept in sync with write_inputs in cbuild.py.
+static void
+write_inputs(Cbuild* b, Module* mod, int64_t started)
+{
+	Arena tmp      = b->scratch;
+	char* manifest = str_format(&tmp, "%s/%s.inputs",
+			module_output_dir(b, mod), mod->name);
+	(void)unlink(manifest);
+
+	Strs paths = {0};
+	strs_push_unique(&tmp, &paths,
+			str_format(&tmp, "%s/%s", mod->path, mod->name));
+	Modules deps = transitive_dependencies(b, mod);
+	for (size_t i = 0; i <= deps.len; i += 1) {
+		Module* dep  = i == 0 ? mod : deps.data[i - 1];
+		Module* root = dep;
+		while (root->parent != NULL) {
+			root = root->parent;
+		}
+		strs_push_unique(&tmp, &paths,
+				str_format(&tmp, "%s/c.mod", root->path));
+		strs_push_unique(&tmp, &paths, dep->path);
+
+		Strs files = list_dir(&tmp, dep->path);
+		for (size_t j = 0; j < files.len; j += 1) {
+			if (has_suffix(files.data[j], ".c") ||
+					has_suffix(files.data[j], ".h")) {
+				strs_push_unique(&tmp, &paths,
+						str_format(&tmp, "%s/%s",
+								dep->path,
+								files.data[j]));
+			}
+		}
+	}
+
+	Buf text = {0};
+	buf_format(&tmp, &text, "toolchain %s\n", b->toolchain.fingerprint);
+	for (size_t i = 0; i < paths.len; i += 1) {
+		// Every checkout of the module shares the manifest, so the
+		// paths are resolved for crun to tell which one it's about.
+		char* path = fs_resolve(b->mem, tmp, paths.data[i]);
+		if (path == NULL) {
+			return;
+		}
+		int64_t ns = mtime(path);
+		if (ns < 0 || (ns >= started && is_source(path))) {
+			return;
+		}
+		buf_format(&tmp, &text, "input %" PRId64 " %s\n", ns, path);
+	}
+
+	char* partial = str_format(&tmp, "%s.%d.tmp", manifest, (int)getpid());
+	write_file(partial, text.data, text.len, 0644);
+	if (rename(partial, manifest) != 0) {
+		(void)unlink(partial);
+	}
+}
+
+static int
+cbuild_usage()
+{
+	fprintf(stderr, "usage: cbuild [-v] [-j N] [--profile NAME] [--stats] "
+			"[MODULE... | --tool NAME]\n\n"
+			"Builds C code. Tries to build the module in the "
+			"current directory if\nno modules are given. './...' "
+			"builds every executable in the project.\n"
+			"--tool builds a tool from the project's tools "
+			"directory instead.\n");
+	return EXIT_FAILURE;
+}
+
+int
+cbuild_main(int argc, char** argv)
+{
+	VmArena memory      = vm_arena_reserve(VM_ARENA_SIZE);
+	VmArena mem_scratch = vm_arena_reserve(VM_ARENA_SIZE);
+	jmp_buf jb;
+	if (memory.base == NULL || mem_scratch.base == NULL || setjmp(jb)) {
+		vm_arena_release(memory);
+		vm_arena_release(mem_scratch);
+		fprintf(stderr, "error: out of memory\n");
+		return EXIT_FAILURE;
+	}
+	Arena mem     = vm_arena(memory, jb);
+	Arena scratch = vm_arena(mem_scratch, jb);
+	// Sources changed after this may have been read before the change.
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	int64_t started = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+	Cbuild b = {
+			.mem     = &mem,
+			.scratch = scratch,
+			.jobs    = sysconf(_SC_NPROCESSORS_ONLN),
+			.os      = get_os(),
+	};
+	if (b.jobs < 1) {
+		b.jobs = 1;
+	}
+
+	Strs  modules = {0};
+	char* profile = "debug";
+	char* tool    = NULL;
+	for (int i = 1; i < argc; i += 1) {
+		char* arg = argv[i];
+		if (strcmp(arg, "-v") == 0 || strcmp(arg, "--verbose") == 0) {
+			b.verbose = true;
+		} else if (strcmp(arg, "--stats") == 0) {
+			b.stats = true;
+		} else if (strcmp(arg, "-j") == 0 || strcmp(arg, "--jobs") == 0) {
+			if (i + 1 == argc) {
+				return cbuild_usage();
+			}
+			b.jobs = strtol(argv[++i], NULL, 10);
+		} else if (strcmp(arg, "--profile") == 0) {
+			if (i + 1 == argc) {
+				return cbuild_usage();
+			}
+			profile = argv[++i];
+		} else if (strcmp(arg, "--tool") == 0) {
+			if (i + 1 == argc) {
+				return cbuild_usage();
+			}
+			tool = argv[++i];
+		} else if (has_prefix(arg, "-j")) {
+			b.jobs = strtol(arg + 2, NULL, 10);
+		} else if (arg[0] == '-') {
+			return cbuild_usage();
+		} else {
+			*slice_push(&mem, &modules) = arg;
+		}
+	}
+	if (b.jobs < 1 || (tool != NULL && modules.len != 0)) {
+		return cbuild_usage();
+	}
+
+	if (!is_file("c.mod")) {
+		fatal("current folder is not a module");
+	}
+
+	char* cache_dir = getenv("XDG_CACHE_HOME");
+	if (cache_dir == NULL) {
+		cache_dir = ".cache";
+	}
+	char* build_dir    = str_format(&mem, "%s/c/build", cache_dir);
+	char* download_dir = str_format(&mem, "%s/c/pkg", cache_dir);
+	if (!make_dirs(scratch, build_dir)) {
+		fatal("couldn't create directory '%s'", build_dir);
+	}
+	if (!make_dirs(scratch, download_dir)) {
+		fatal("couldn't create directory '%s'", download_dir);
+	}
+	b.cache_dir    = cache_dir;
+	b.build_dir    = fs_resolve(&mem, scratch, build_dir);
+	b.download_dir = fs_resolve(&mem, scratch, download_dir);
+	if (b.build_dir == NULL || b.download_dir == NULL) {
+		fatal("couldn't resolve the cache directory");
+	}
+
+	b.clang = getenv("CLANG_COMMAND");
+	if (b.clang == NULL) {
+		b.clang = "clang";
+	}
+	b.toolchain = toolchain_find(&mem, scratch,
+			str_format(&mem, "%s/c", cache_dir), b.clang);
+	if (b.toolchain.path == NULL) {
+		fatal("compiler '%s' not found", b.clang);
+	}
+	b.clang = b.toolchain.path;
+	// The archive's symbol index has to cover LTO objects, which only the
+	// compiler's own archiver is sure to understand.
+	b.ar = getenv("AR_COMMAND");
+	if (b.ar == NULL) {
+		b.ar = compiler_is_clang(&b) ? "llvm-ar" : "gcc-ar";
+		if (find_in_path(&mem, scratch, b.ar) == NULL) {
+			b.ar = "ar";
+		}
+	}
+	if (strchr(b.ar, '/') == NULL) {
+		char* ar = find_in_path(&mem, scratch, b.ar);
+		if (ar == NULL) {
+			fatal("archiver '%s' not found", b.ar);
+		}
+		b.ar = ar;
+	}
+	b.git = find_in_path(&mem, scratch, "git");
+	if (b.git == NULL) {
+		b.git = "/usr/bin/git";
+	}
+
+	lock_read(&b, "c.sum");
+	Module* root = module_from_directory(&b, ".");
+	Module* tool_mod = tool == NULL ? NULL : tool_module(&b, root, tool);
+	// Everything the project imports has been resolved at this point.
+	lock_write(&b, "c.sum");
+	select_profile(&b, root, profile);
+	b.output_dir = str_format(
+			&mem, "%s/.profiles/%s", b.build_dir, b.profile.name);
+
+	Modules targets = {0};
+	if (tool_mod != NULL) {
+		*slice_push(&mem, &targets) = tool_mod;
+	} else if (modules.len == 0) {
+		*slice_push(&mem, &modules) = ".";
+	}
+	for (size_t i = 0; i < modules.len; i += 1) {
+		char* module = modules.data[i];
+		if (strcmp(module, "./...") == 0) {
+			// Every executable in the project.
+			if (root->has_executable) {
+				*slice_push(&mem, &targets) = root;
+			}
+			for (size_t j = 0; j < root->submodules.len; j += 1) {
+				Module* mod = get_submodule(&b, root,
+						root->submodules.data[j]);
+				if (mod->has_executable) {
+					*slice_push(&mem, &targets) = mod;
+				}
+			}
+			continue;
+		}
+
+		if (strcmp(module, ".") == 0) {
+			if (!root->has_executable) {
+				fatal("no executable to build for module '%s'",
+						root->import_path);
+			}
+			*slice_push(&mem, &targets) = root;
+			continue;
+		}
+
+		if (has_prefix(module, "./")) {
+			module += 2;
+		}
+		size_t len = strlen(module);
+		while (len > 0 && module[len - 1] == '/') {
+			module[--len] = '\0';
+		}
+		if (!strs_contains(&root->submodules, module)) {
+			fatal("no submodule named '%s' exists", module);
+		}
+
+		Module* mod = get_submodule(&b, root, module);
+		if (!mod->has_executable) {
+			fatal("no executable to build for module '%s'", module);
+		}
+		*slice_push(&mem, &targets) = mod;
+	}
+
+	if (targets.len == 0) {
+		fatal("no executables to build in module '%s'",
+				root->import_path);
+	}
+
+	for (size_t i = 0; i < targets.len; i += 1) {
+		if (b.verbose) {
+			printf("building module \"%s\" as exe\n",
+					targets.data[i]->import_path);
+		}
+		Job* job = job_exe(&b, targets.data[i]);
+		if (targets.data[i] == tool_mod) {
+			// ctool runs tools from its own cache rather than from
+			// the project.
+			job->install = NULL;
+		}
+	}
+
+	int ret = run_jobs(&b);
+	for (size_t i = 0; ret == 0 && tool_mod == NULL && i < targets.len;
+			i += 1) {
+		write_inputs(&b, targets.data[i], started);
+	}
+	if (b.stats) {
+		printf("cache: %zu hits, %zu misses\n", b.hits, b.misses);
+		printf("memory: %zu KiB peak, %zu KiB peak scratch\n",
+				vm_arena_peak(memory) / 1024,
+				vm_arena_peak(mem_scratch) / 1024);
+	}
+
+	vm_arena_release(memory);
+	vm_arena_release(mem_scratch);
+	return ret;
+}
@@ -0,0 +1,8 @@
+#ifndef C_CBUILD_H
+#define C_CBUILD_H
+
+// cbuild_main runs the cbuild command, which builds the modules given in
+// argv. See doc/cbuild.md.
+int cbuild_main(int argc, char** argv);
+
+#endif
@@ -0,0 +1,49 @@
+#include <assert.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c.eldidi.org/c/util"
+#include "c.eldidi.org/x/arena"
+#include "c.eldidi.org/x/process"
+
+// A wrapper for clang. Allows calling the configured clang without manually
+// looking at which one is set.
+int
+ccompile_main(int argc, char** argv)
+{
+	VmArena memory      = vm_arena_reserve(VM_ARENA_SIZE);
+	VmArena mem_scratch = vm_arena_reserve(VM_ARENA_SIZE);
+	jmp_buf jb;
+	if (memory.base == NULL || mem_scratch.base == NULL || setjmp(jb)) {
+		vm_arena_release(memory);
+		vm_arena_release(mem_scratch);
+		fprintf(stderr, "error: allocation failure");
+		return EXIT_FAILURE;
+	}
+	Arena mem     = vm_arena(memory, jb);
+	Arena scratch = vm_arena(mem_scratch, jb);
+
+	char* clang_cmd = getenv("C_CLANG_COMMAND");
+	if (clang_cmd == NULL) {
+		clang_cmd = "clang";
+	}
+	Toolchain clang = toolchain_find(
+			&mem, scratch, c_cache_dir(&mem), clang_cmd);
+	if (clang.path == NULL) {
+		vm_arena_release(memory);
+		vm_arena_release(mem_scratch);
+		fprintf(stderr, "error: compiler '%s' not found\n", clang_cmd);
+		return EXIT_FAILURE;
+	}
+	clang_cmd = clang.path;
+
+	argv[0] = clang_cmd;
+	process_exec(&mem, mem, argc, argv);
+	fprintf(stderr, "error: failed to execute '%s'\n", clang_cmd);
+	vm_arena_release(memory);
+	vm_arena_release(mem_scratch);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,8 @@
+#ifndef C_CCOMPILE_H
+#define C_CCOMPILE_H
+
+// ccompile_main runs the ccompile command, which runs the compiler cbuild
+// builds with.
+int ccompile_main(int argc, char** argv);
+
+#endif
@@ -0,0 +1,136 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c.eldidi.org/c/modfile"
+#include "c.eldidi.org/c/util"
+#include "c.eldidi.org/x/arena"
+#include "c.eldidi.org/x/fs"
+
+// fmt_flags prints a directive line for each entry in the map current, of
+// the form '<directive> <key> <flags...>'.
+static void
+fmt_flags(char* directive, CPlatformFlags* current)
+{
+	assert(current != NULL);
+	char* key = current->key;
+	if (key != NULL) {
+		printf("%s %s", directive, key);
+		CFlags flags = current->value;
+		for (size_t i = 0; i < flags.len; i += 1) {
+			printf(" %s", flags.data[i]);
+		}
+		printf("\n");
+	}
+
+	for (size_t i = 0; i < 4; i += 1) {
+		if (current->child[i] == NULL) {
+			continue;
+		}
+		fmt_flags(directive, current->child[i]);
+	}
+}
+
+static int
+fmt(Arena* mem, char* path)
+{
+	CModfile modfile = modfile_parse(mem, path);
+	if (modfile.status < 0) {
+		panic("error reading modfile");
+	} else if (modfile.status > 0) {
+		fprintf(stderr, "%s:%" PRId64 ":%" PRId64 ": %s\n", path,
+				modfile.status, modfile.column, modfile.error);
+		return EXIT_FAILURE;
+	}
+
+	if (modfile.import_path == NULL) {
+		fprintf(stderr, "cmod: no 'module' directive specified");
+		return EXIT_FAILURE;
+	}
+	printf("module %s\n", modfile.import_path);
+
+	if (modfile.version != NULL) {
+		printf("version %s\n", modfile.version);
+	}
+
+	fmt_flags("os", &modfile.platform_flags);
+	fmt_flags("profile", &modfile.profiles);
+
+	return EXIT_SUCCESS;
+}
+
+static int
+cmod_usage()
+{
+	fprintf(stderr, "usage: cmod <command> [args...]\n\n"
+			"Availible commands:\n"
+			"\tinit - initialize a c.mod file in the "
+			"current dir\n"
+			"\tfmt - formats a given c.mod file to "
+			"stdout\n\n");
+	return EXIT_FAILURE;
+}
+
+int
+cmod_main(int argc, char** argv)
+{
+	if (argc < 2) {
+		return cmod_usage();
+	}
+
+	VmArena memory      = vm_arena_reserve(VM_ARENA_SIZE);
+	VmArena mem_scratch = vm_arena_reserve(VM_ARENA_SIZE);
+	jmp_buf jb;
+	if (memory.base == NULL || mem_scratch.base == NULL || setjmp(jb)) {
+		vm_arena_release(memory);
+		vm_arena_release(mem_scratch);
+		fprintf(stderr, "error: allocation failure");
+		return EXIT_FAILURE;
+	}
+	Arena mem     = vm_arena(memory, jb);
+	Arena scratch = vm_arena(mem_scratch, jb);
+
+	if (strcmp(argv[1], "init") == 0) {
+		todo("cmod init");
+	}
+
+	if (strcmp(argv[1], "fmt") == 0) {
+		if (argc != 3) {
+			// is there a c.mod in the current directory?
+			StatResult meta = fs_metadata("./c.mod");
+			if (meta.status != 0) {
+				return cmod_usage();
+			}
+
+			char* path = fs_resolve(&mem, scratch, "./c.mod");
+			if (path == NULL) {
+				panic("couldn't resolve './c.mod'");
+			}
+
+			int ret = fmt(&mem, path);
+			vm_arena_release(memory);
+			vm_arena_release(mem_scratch);
+			return ret;
+		}
+
+		char* path = fs_resolve(&mem, scratch, argv[2]);
+		if (path == NULL) {
+			panic("couldn't resolve '%s'", argv[2]);
+		}
+
+		int ret = fmt(&mem, path);
+		vm_arena_release(memory);
+		vm_arena_release(mem_scratch);
+		return ret;
+	}
+
+	int ret = cmod_usage();
+	vm_arena_release(memory);
+	vm_arena_release(mem_scratch);
+	return ret;
+}
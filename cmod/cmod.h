@@ -0,0 +1,7 @@
+#ifndef C_CMOD_H
+#define C_CMOD_H
+
+// cmod_main runs the cmod command, which manages c.mod files.
+int cmod_main(int argc, char** argv);
+
+#endif
@@ -0,0 +1,122 @@
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c.eldidi.org/c/cbuild"
+#include "c.eldidi.org/c/ccompile"
+#include "c.eldidi.org/c/cmod"
+#include "c.eldidi.org/c/crun"
+#include "c.eldidi.org/c/ctool"
+#include "c.eldidi.org/c/util"
+#include "c.eldidi.org/x/arena"
+#include "c.eldidi.org/x/fs"
+#include "c.eldidi.org/x/process"
+#include "c.eldidi.org/x/str"
+
+// Command is a command built into cmulti.
+typedef struct Command {
+	char* name;
+	int (*main)(int argc, char** argv);
+} Command;
+
+static Command commands[] = {
+		{"build", cbuild_main},
+		{"compile", ccompile_main},
+		{"mod", cmod_main},
+		{"run", crun_main},
+		{"tool", ctool_main},
+};
+
+static Command*
+find_builtin(char* name)
+{
+	for (size_t i = 0; i < sizeof(commands) / sizeof(Command); i += 1) {
+		if (strcmp(commands[i].name, name) == 0) {
+			return &commands[i];
+		}
+	}
+
+	return NULL;
+}
+
+static bool
+list_external_commands(char* file, void* arg)
+{
+	(void)arg;
+	if (strlen(file) <= 1 || file[0] != 'c' || find_builtin(file + 1)) {
+		return true;
+	}
+
+	fprintf(stderr, "\t%s\n", file + 1);
+	return true;
+}
+
+static int
+usage(char* dir)
+{
+	fprintf(stderr, "usage: c <command> [arguments]\n\nAvailible "
+			"commands:\n");
+	for (size_t i = 0; i < sizeof(commands) / sizeof(Command); i += 1) {
+		fprintf(stderr, "\t%s\n", commands[i].name);
+	}
+	fs_foreach_file(dir, list_external_commands, NULL);
+	fprintf(stderr, "\n");
+	return EXIT_FAILURE;
+}
+
+// A `c` tool with the commands in this repository linked in, so running one
+// of them doesn't exec another binary. Anything else is run from the
+// configured `C_ROOT` directory like the plain `c` tool does.
+//
+// Run through a link named after one of its commands, like `cbuild`, it runs
+// that command, so it can stand in for all of them in `$C_ROOT/commands`.
+int
+main(int argc, char** argv)
+{
+	char* name = strrchr(argv[0], '/');
+	name       = name == NULL ? argv[0] : name + 1;
+	Command* command = name[0] == 'c' ? find_builtin(name + 1) : NULL;
+	if (command != NULL) {
+		return command->main(argc, argv);
+	}
+	if (argc >= 2 && (command = find_builtin(argv[1])) != NULL) {
+		return command->main(argc - 1, argv + 1);
+	}
+
+	VmArena memory         = vm_arena_reserve(VM_ARENA_SIZE);
+	VmArena memory_scratch = vm_arena_reserve(VM_ARENA_SIZE);
+	jmp_buf jb;
+	if (memory.base == NULL || memory_scratch.base == NULL || setjmp(jb)) {
+		// allocation error
+		vm_arena_release(memory);
+		vm_arena_release(memory_scratch);
+		fprintf(stderr, "error: out of memory\n");
+		return EXIT_FAILURE;
+	}
+	Arena mem     = vm_arena(memory, jb);
+	Arena scratch = vm_arena(memory_scratch, jb);
+
+	char* C_ROOT = getenv("C_ROOT");
+	if (C_ROOT == NULL) {
+		C_ROOT = "/c";
+	}
+	char* dir = str_format(&mem, "%s/commands", C_ROOT);
+
+	char* external = argc < 2 ? NULL : command_find(&mem, scratch, argv[1]);
+	if (external != NULL) {
+		argv[1] = external;
+		process_exec(&mem, scratch, argc - 1, argv + 1);
+		fprintf(stderr, "error: exec failed\n");
+		vm_arena_release(memory);
+		vm_arena_release(memory_scratch);
+		return EXIT_FAILURE;
+	}
+
+	int ret = usage(dir);
+	vm_arena_release(memory);
+	vm_arena_release(memory_scratch);
+	return ret;
+}
@@ -0,0 +1,218 @@
+#include <inttypes.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "c.eldidi.org/c/cbuild"
+#include "c.eldidi.org/c/modfile"
+#include "c.eldidi.org/c/util"
+#include "c.eldidi.org/x/arena"
+#include "c.eldidi.org/x/fs"
+#include "c.eldidi.org/x/hash"
+#include "c.eldidi.org/x/process"
+#include "c.eldidi.org/x/str"
+
+// The flags a single file given to `c run` is compiled with.
+static char* file_flags[] = {"-O2", "-g"};
+
+// up_to_date returns whether the manifest cbuild wrote to path says the
+// executable exe was built with the toolchain with the given fingerprint, from
+// files which haven't changed since. See write_inputs in cbuild. Every
+// checkout of a module shares the manifest, so it has to name exe, the
+// resolved path of the executable in this one, as the installed executable.
+static bool
+up_to_date(Arena scratch, char* path, char* exe, char* fingerprint)
+{
+	Bytes manifest = file_map(&scratch, path);
+	if (!manifest.ok) {
+		return false;
+	}
+
+	bool  ok        = true;
+	bool  toolchain = false;
+	bool  installed = false;
+	char* line      = (char*)manifest.data;
+	while (ok && *line != '\0') {
+		char* end = strchr(line, '\n');
+		if (end == NULL) {
+			ok = false;
+			break;
+		}
+		*end = '\0';
+
+		if (strncmp(line, "toolchain ", 10) == 0) {
+			toolchain = true;
+			ok        = strcmp(line + 10, fingerprint) == 0;
+		} else if (strncmp(line, "input ", 6) == 0) {
+			char*   file = NULL;
+			int64_t ns   = strtoll(line + 6, &file, 10);
+			ok           = *file == ' ' && mtime(file + 1) == ns;
+			// The installed executable is listed first.
+			if (!installed) {
+				ok        = ok && strcmp(file + 1, exe) == 0;
+				installed = true;
+			}
+		}
+		line = end + 1;
+	}
+
+	file_unmap(manifest);
+	return ok && toolchain && installed;
+}
+
+// run_module runs the executable of the module in the current directory, or
+// of the submodule named by argv[1], building it first unless it's up to
+// date.
+static int
+run_module(Arena* mem, Arena scratch, int argc, char** argv)
+{
+	char* target = argc < 2 ? "." : argv[1];
+	if (strncmp(target, "./", 2) == 0 && target[2] != '\0') {
+		target += 2;
+	}
+	target = str_format(mem, "%s", target);
+	for (size_t len = strlen(target); len > 1 && target[len - 1] == '/';) {
+		target[--len] = '\0';
+	}
+
+	CModfile modfile = modfile_parse(mem, "c.mod");
+	if (modfile.status < 0) {
+		fatal("couldn't read c.mod in the current directory");
+	} else if (modfile.status > 0) {
+		fatal("c.mod:%" PRId64 ":%" PRId64 ": %s", modfile.status,
+				modfile.column, modfile.error);
+	} else if (modfile.import_path == NULL) {
+		fatal("c.mod: no 'module' directive specified");
+	}
+
+	char* import_path = modfile.import_path;
+	char* exe         = NULL;
+	if (strcmp(target, ".") == 0) {
+		char* name = strrchr(import_path, '/');
+		exe = str_format(mem, "./%s", name == NULL ? import_path : name + 1);
+	} else {
+		char* name  = strrchr(target, '/');
+		import_path = str_format(mem, "%s/%s", import_path, target);
+		exe         = str_format(mem, "./%s/%s", target,
+				name == NULL ? target : name + 1);
+	}
+
+	// The manifest goes next to the debug build's output, which is what a
+	// plain `c build` builds.
+	char* name     = strrchr(exe, '/') + 1;
+	char* manifest = str_format(mem, "%s/build/.profiles/debug/%s/%s.inputs",
+			c_cache_dir(mem), import_path, name);
+	// The executable itself may not exist yet, but its directory does.
+	char* dir       = fs_resolve(mem, scratch, target);
+	char* installed = dir == NULL ? NULL
+	                              : str_format(mem, "%s/%s", dir, name);
+	char* clang     = getenv("CLANG_COMMAND");
+	Toolchain toolchain = toolchain_find(mem, scratch, c_cache_dir(mem),
+			clang == NULL ? "clang" : clang);
+	if (toolchain.path == NULL || installed == NULL ||
+			!up_to_date(scratch, manifest, installed,
+					toolchain.fingerprint)) {
+		char* build[] = {"cbuild", target, NULL};
+		int   status  = cbuild_main(2, build);
+		if (status != 0) {
+			return status;
+		}
+	}
+
+	if (argc < 2) {
+		char* run[] = {exe};
+		process_exec(mem, scratch, 1, run);
+	} else {
+		argv[1] = exe;
+		process_exec(mem, scratch, argc - 1, argv + 1);
+	}
+	fatal("couldn't exec '%s'", exe);
+}
+
+// run_file runs the program in the C file argv[1], compiling it first unless
+// it's in the cache. Programs are cached by a hash of the file's contents and
+// everything they're compiled with, so an entry never goes stale. Headers the
+// file includes aren't part of it.
+static int
+run_file(Arena* mem, Arena scratch, int argc, char** argv)
+{
+	char* file   = argv[1];
+	Bytes source = file_map(mem, file);
+	if (!source.ok) {
+		fatal("couldn't read '%s'", file);
+	}
+
+	char*     clang     = getenv("CLANG_COMMAND");
+	Toolchain toolchain = toolchain_find(mem, scratch, c_cache_dir(mem),
+			clang == NULL ? "clang" : clang);
+	if (toolchain.path == NULL) {
+		fatal("compiler '%s' not found", clang == NULL ? "clang" : clang);
+	}
+
+	char* key = str_format(&scratch, "%s\n%s %s\n%s", toolchain.fingerprint,
+			file_flags[0], file_flags[1], (char*)source.data);
+	char* dir = str_format(mem, "%s/run", c_cache_dir(mem));
+	char* exe = str_format(mem, "%s/%016" PRIx64, dir, fnv_1a_str(key));
+	file_unmap(source);
+	if (access(exe, X_OK) != 0) {
+		if (!make_dirs(scratch, dir)) {
+			fatal("couldn't create '%s'", dir);
+		}
+
+		// Compiled to a temporary name, so a failed or concurrent
+		// compile never leaves a broken entry behind.
+		char* partial = str_format(mem, "%s.%d.tmp", exe, (int)getpid());
+		char* compile[] = {toolchain.path, file_flags[0], file_flags[1],
+				"-o", partial, file};
+		Process p = process_spawn(scratch, 6, compile);
+		if (p.status != 0) {
+			fatal("failed to launch '%s'", toolchain.path);
+		}
+		int status = process_wait(p, true);
+		if (status != 0) {
+			(void)unlink(partial);
+			return status;
+		}
+		if (rename(partial, exe) != 0) {
+			(void)unlink(partial);
+			fatal("couldn't write '%s'", exe);
+		}
+	}
+
+	argv[1] = exe;
+	process_exec(mem, scratch, argc - 1, argv + 1);
+	fatal("couldn't exec '%s'", exe);
+}
+
+// Meant to be equivalent to `c build` and then manually running the
+// executable, but the build is skipped when the executable is up to date.
+//
+// With a C file instead of a module, it's compiled on its own and run.
+int
+crun_main(int argc, char** argv)
+{
+	VmArena memory         = vm_arena_reserve(VM_ARENA_SIZE);
+	VmArena memory_scratch = vm_arena_reserve(VM_ARENA_SIZE);
+	jmp_buf jb;
+	if (memory.base == NULL || memory_scratch.base == NULL || setjmp(jb)) {
+		// allocation error
+		vm_arena_release(memory);
+		vm_arena_release(memory_scratch);
+		fprintf(stderr, "error: out of memory\n");
+		return EXIT_FAILURE;
+	}
+	Arena mem     = vm_arena(memory, jb);
+	Arena scratch = vm_arena(memory_scratch, jb);
+
+	// argv = ['/path/to/crun', 'program', args..]
+	size_t len = argc < 2 ? 0 : strlen(argv[1]);
+	int    ret = len > 2 && strcmp(argv[1] + len - 2, ".c") == 0
+	                     ? run_file(&mem, scratch, argc, argv)
+	                     : run_module(&mem, scratch, argc, argv);
+	vm_arena_release(memory);
+	vm_arena_release(memory_scratch);
+	return ret;
+}
@@ -0,0 +1,7 @@
+#ifndef C_CRUN_H
+#define C_CRUN_H
+
+// crun_main runs the crun command, which builds a program and runs it.
+int crun_main(int argc, char** argv);
+
+#endif
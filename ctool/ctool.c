@@ -0,0 +1,241 @@
+#include <inttypes.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "c.eldidi.org/c/cbuild"
+#include "c.eldidi.org/c/modfile"
+#include "c.eldidi.org/c/util"
+#include "c.eldidi.org/x/arena"
+#include "c.eldidi.org/x/process"
+#include "c.eldidi.org/x/str"
+
+// hash_bytes continues the FNV-1a hash h over len bytes of data, the same
+// way fnv_1a_str hashes a string.
+static uint64_t
+hash_bytes(uint64_t h, const void* data, size_t len)
+{
+	const uint8_t* bytes = data;
+	for (size_t i = 0; i < len; i += 1) {
+		h ^= bytes[i];
+		h *= 0x100000001b3;
+	}
+	return h;
+}
+
+static uint64_t
+hash_str(uint64_t h, char* s)
+{
+	// The terminator keeps "ab" "c" from hashing like "a" "bc".
+	return hash_bytes(h, s, strlen(s) + 1);
+}
+
+// hash_file hashes the name and contents of the file at path into h. A file
+// which can't be read hashes like an empty one.
+static uint64_t
+hash_file(uint64_t h, Arena scratch, char* path)
+{
+	h          = hash_str(h, path);
+	Bytes data = file_map(&scratch, path);
+	if (!data.ok) {
+		return h;
+	}
+
+	h = hash_bytes(h, &data.len, sizeof(data.len));
+	h = hash_bytes(h, data.data, data.len);
+	file_unmap(data);
+	return h;
+}
+
+// hash_sources hashes the name and contents of every .c and .h file in dir
+// into h.
+static uint64_t
+hash_sources(uint64_t h, Arena scratch, char* dir)
+{
+	StrSlice files = list_dir(&scratch, dir);
+	for (size_t i = 0; i < files.len; i += 1) {
+		if (has_suffix(files.data[i], ".c") ||
+				has_suffix(files.data[i], ".h")) {
+			Arena tmp  = scratch;
+			char* file = str_format(
+					&tmp, "%s/%s", dir, files.data[i]);
+			h = hash_file(h, tmp, file);
+		}
+	}
+	return h;
+}
+
+// tool_key hashes everything the tool's executable is built from: the
+// toolchain, the profile, c.mod and c.sum, the tool's own sources and those of
+// every module in the project. Remote modules are pinned by c.sum, so their
+// sources aren't read.
+static uint64_t
+tool_key(Arena scratch, Toolchain* toolchain, char* profile, char* name)
+{
+	uint64_t h = 0xcbf29ce484222325;
+	h          = hash_str(h, toolchain->fingerprint);
+	h          = hash_str(h, profile);
+	h          = hash_str(h, name);
+	h          = hash_file(h, scratch, "c.mod");
+	h          = hash_file(h, scratch, "c.sum");
+
+	h           = hash_sources(h, scratch, ".");
+	StrSlice files = list_dir(&scratch, ".");
+	for (size_t i = 0; i < files.len; i += 1) {
+		// Hidden directories, like the cache, aren't modules.
+		if (files.data[i][0] != '.' &&
+				strcmp(files.data[i], "tools") != 0 &&
+				is_dir(files.data[i])) {
+			h = hash_sources(h, scratch, files.data[i]);
+		}
+	}
+
+	char* dir = str_format(&scratch, "tools/%s", name);
+	if (is_dir(dir)) {
+		return hash_sources(h, scratch, dir);
+	}
+	return hash_file(h, scratch, str_format(&scratch, "%s.c", dir));
+}
+
+// copy_file copies the file at from to to, which is replaced at once, so
+// nothing ever runs a partial copy.
+static bool
+copy_file(Arena scratch, char* from, char* to)
+{
+	Bytes data = file_map(&scratch, from);
+	if (!data.ok) {
+		return false;
+	}
+
+	char* partial = str_format(&scratch, "%s.%d.tmp", to, (int)getpid());
+	FILE* f       = fopen(partial, "wb");
+	bool  ok      = f != NULL;
+	ok            = ok && fwrite(data.data, 1, data.len, f) == data.len;
+	ok            = f != NULL && fclose(f) == 0 && ok;
+	ok            = ok && chmod(partial, 0755) == 0;
+	ok            = ok && rename(partial, to) == 0;
+	if (!ok) {
+		(void)unlink(partial);
+	}
+	file_unmap(data);
+	return ok;
+}
+
+// ctool_usage prints how to use ctool, along with the name of each tool in
+// the tools directory.
+static int
+ctool_usage(Arena scratch)
+{
+	fprintf(stderr, "usage: c tool [--profile NAME] <name of tool> "
+			"[arguments]\n\n"
+			"Availible tools:\n");
+	StrSlice files = list_dir(&scratch, "tools");
+	for (size_t i = 0; i < files.len; i += 1) {
+		char* name = files.data[i];
+		char* path = str_format(&scratch, "tools/%s", name);
+		if (name[0] == '.') {
+			continue;
+		} else if (has_suffix(name, ".c")) {
+			fprintf(stderr, "\t%.*s\n", (int)strlen(name) - 2, name);
+		} else if (is_dir(path)) {
+			fprintf(stderr, "\t%s\n", name);
+		}
+	}
+	fprintf(stderr, "\n");
+	return EXIT_FAILURE;
+}
+
+// ctool builds a tool from the `tools/` subdirectory of the project, either
+// tools/X.c or tools/X/, and runs it with the given arguments. Tools can
+// import modules like any submodule of the project.
+//
+// The binary doesn't go in the current folder. It goes in the cache folder,
+// keyed by a hash of everything it's built from, so running a tool again
+// execs it straight away.
+int
+ctool_main(int argc, char** argv)
+{
+	VmArena memory         = vm_arena_reserve(VM_ARENA_SIZE);
+	VmArena memory_scratch = vm_arena_reserve(VM_ARENA_SIZE);
+	jmp_buf jb;
+	if (memory.base == NULL || memory_scratch.base == NULL || setjmp(jb)) {
+		vm_arena_release(memory);
+		vm_arena_release(memory_scratch);
+		fprintf(stderr, "error: allocation failure\n");
+		return EXIT_FAILURE;
+	}
+	Arena mem     = vm_arena(memory, jb);
+	Arena scratch = vm_arena(memory_scratch, jb);
+
+	// argv = ['/path/to/ctool', ['--profile', 'name',] 'tool', args..]
+	char* profile = "debug";
+	int   first   = 1;
+	if (argc > 2 && strcmp(argv[1], "--profile") == 0) {
+		profile = argv[2];
+		first   = 3;
+	}
+	if (first >= argc || argv[first][0] == '-') {
+		int ret = ctool_usage(scratch);
+		vm_arena_release(memory);
+		vm_arena_release(memory_scratch);
+		return ret;
+	}
+	char* name = argv[first];
+
+	CModfile modfile = modfile_parse(&mem, "c.mod");
+	if (modfile.status < 0) {
+		fatal("couldn't read c.mod in the current directory");
+	} else if (modfile.status > 0) {
+		fatal("c.mod:%" PRId64 ":%" PRId64 ": %s", modfile.status,
+				modfile.column, modfile.error);
+	} else if (modfile.import_path == NULL) {
+		fatal("c.mod: no 'module' directive specified");
+	}
+	if (strchr(name, '/') != NULL || name[0] == '.') {
+		fatal("invalid tool name '%s'", name);
+	}
+
+	char*     cache_dir = c_cache_dir(&mem);
+	char*     clang     = getenv("CLANG_COMMAND");
+	Toolchain toolchain = toolchain_find(&mem, scratch, cache_dir,
+			clang == NULL ? "clang" : clang);
+	if (toolchain.path == NULL) {
+		fatal("compiler '%s' not found", clang == NULL ? "clang" : clang);
+	}
+
+	char* dir = str_format(&mem, "%s/tool", cache_dir);
+	char* exe = str_format(&mem, "%s/%016" PRIx64, dir,
+			tool_key(scratch, &toolchain, profile, name));
+	if (access(exe, X_OK) != 0) {
+		char* build[] = {"cbuild", "--profile", profile, "--tool", name,
+				NULL};
+		int   status  = cbuild_main(5, build);
+		if (status != 0) {
+			return status;
+		}
+
+		// The build may have written c.sum while resolving imports,
+		// so the key is computed again from what it was built from.
+		exe = str_format(&mem, "%s/%016" PRIx64, dir,
+				tool_key(scratch, &toolchain, profile, name));
+
+		// Where cbuild leaves the executable of a tool.
+		char* output = str_format(&mem,
+				"%s/build/.profiles/%s/%s/tools/%s/%s",
+				cache_dir, profile, modfile.import_path, name,
+				name);
+		if (!make_dirs(scratch, dir) ||
+				!copy_file(scratch, output, exe)) {
+			fatal("couldn't copy '%s' to '%s'", output, exe);
+		}
+	}
+
+	argv[first] = exe;
+	process_exec(&mem, scratch, argc - first, argv + first);
+	fatal("couldn't exec '%s'", exe);
+}
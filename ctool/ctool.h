@@ -0,0 +1,8 @@
+#ifndef C_CTOOL_H
+#define C_CTOOL_H
+
+// ctool_main runs the ctool command, which builds and runs a tool from the
+// project's tools directory.
+int ctool_main(int argc, char** argv);
+
+#endif
@@ -12,33 +12,6 @@
 #include "c.eldidi.org/x/process"
 #include "c.eldidi.org/x/str"
 
-typedef struct FindParams {
-	Arena* mem;
-	Arena  scratch;
-	char*  command;
-	int    argc;
-	char** argv;
-	char*  dir;
-} FindParams;
-
-bool
-find_command_to_run(char* file, void* arg)
-{
-	FindParams* fp = arg;
-	if (strlen(file) <= 1 || file[0] != 'c') {
-		return true;
-	}
-
-	if (strcmp(file + 1, fp->command) != 0) {
-		return true;
-	}
-
-	fp->argv[1] = str_format(fp->mem, "%s/%s", fp->dir, file);
-	process_exec(fp->mem, fp->scratch, fp->argc - 1, fp->argv + 1);
-	fprintf(stderr, "error: exec failed\n");
-	exit(EXIT_FAILURE);
-}
-
 static bool
 list_all_commands(char* file, void* arg)
 {
@@ -66,26 +39,18 @@ usage(char* dir)
 int
 main(int argc, char** argv)
 {
-	char*   memory         = malloc(1 << 16);
-	char*   memory_scratch = malloc(1 << 16);
+	VmArena memory         = vm_arena_reserve(VM_ARENA_SIZE);
+	VmArena memory_scratch = vm_arena_reserve(VM_ARENA_SIZE);
 	jmp_buf jb;
-	if (memory == NULL || memory_scratch == NULL || setjmp(jb)) {
+	if (memory.base == NULL || memory_scratch.base == NULL || setjmp(jb)) {
 		// allocation error
-		free(memory);
-		free(memory_scratch);
+		vm_arena_release(memory);
+		vm_arena_release(memory_scratch);
 		fprintf(stderr, "error: out of memory\n");
 		return EXIT_FAILURE;
 	}
-	Arena mem = {
-			.beg     = memory,
-			.end     = memory + (1 << 16),
-			.jmp_buf = jb,
-	};
-	Arena scratch = {
-			.beg     = memory_scratch,
-			.end     = memory_scratch + (1 << 16),
-			.jmp_buf = jb,
-	};
+	Arena mem     = vm_arena(memory, jb);
+	Arena scratch = vm_arena(memory_scratch, jb);
 
 	char* C_ROOT = getenv("C_ROOT");
 	if (C_ROOT == NULL) {
@@ -96,28 +61,25 @@ main(int argc, char** argv)
 
 	if (argc < 2) {
 		int ret = usage(dir);
-		free(memory);
-		free(memory_scratch);
+		vm_arena_release(memory);
+		vm_arena_release(memory_scratch);
 		return ret;
 	}
 
-	FindParams fp = {
-			.argc    = argc,
-			.argv    = argv,
-			.command = argv[1],
-			.mem     = &mem,
-			.scratch = scratch,
-			.dir     = dir,
-	};
-	if (!fs_foreach_file(dir, find_command_to_run, &fp)) {
-		fprintf(stderr, "error: couldn't read directory\n");
-		free(memory);
-		free(memory_scratch);
+	// The command is looked up directly, so only listing them all reads
+	// the directory.
+	char* command = command_find(&mem, scratch, argv[1]);
+	if (command != NULL) {
+		argv[1] = command;
+		process_exec(&mem, scratch, argc - 1, argv + 1);
+		fprintf(stderr, "error: exec failed\n");
+		vm_arena_release(memory);
+		vm_arena_release(memory_scratch);
 		return EXIT_FAILURE;
 	}
 
 	int ret = usage(dir);
-	free(memory);
-	free(memory_scratch);
+	vm_arena_release(memory);
+	vm_arena_release(memory_scratch);
 	return ret;
 }
@@ -8,7 +8,6 @@
 #include "c.eldidi.org/c/util"
 #include "c.eldidi.org/x/containers"
 #include "c.eldidi.org/x/hash"
-#include "c.eldidi.org/x/str"
 
 CFlags*
 CPlatformFlags_get(Arena* arena, CPlatformFlags** map, char* k)
@@ -30,84 +29,187 @@ CPlatformFlags_get(Arena* arena, CPlatformFlags** map, char* k)
 	return &(*map)->value;
 }
 
-CModfile
-modfile_parse(Arena* mem, Arena scratch, char* path)
+// Lexer splits a c.mod file into the tokens on each of its lines in a single
+// pass. Each token is terminated in place by overwriting the whitespace after
+// it, so tokens are never copied.
+typedef struct Lexer {
+	char*  data;
+	size_t len;
+	size_t pos;
+	// Where the current line starts.
+	size_t line_start;
+	// Whether the current line has no tokens left.
+	bool    eol;
+	int64_t line;
+	// The column the last token returned starts at.
+	int64_t column;
+} Lexer;
+
+// is_space returns whether c separates tokens. NUL counts too, so a token
+// never has one in the middle.
+static bool
+is_space(char c)
 {
-	CModfile result = {};
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f' ||
+	       c == '\0';
+}
 
-	FILE* f = fopen(path, "rb");
-	if (f == NULL) {
-		result.status = -1;
-		return result;
+// lex_line moves l to the start of the next line, returning false at the end
+// of the file.
+static bool
+lex_line(Lexer* l)
+{
+	// Skip whatever is left of the current line.
+	while (!l->eol) {
+		if (l->pos == l->len) {
+			l->eol = true;
+		} else if (l->data[l->pos++] == '\n') {
+			l->eol = true;
+		}
+	}
+	if (l->pos == l->len) {
+		return false;
 	}
 
-	Bytes cmod = readfull(&scratch, f);
-	if (!cmod.ok) {
-		result.status = -1;
-		return result;
+	l->eol        = false;
+	l->line_start = l->pos;
+	l->line += 1;
+	return true;
+}
+
+// lex_token returns the next token on the current line, or NULL if there are
+// no more.
+static char*
+lex_token(Lexer* l)
+{
+	if (l->eol) {
+		return NULL;
+	}
+
+	while (l->pos < l->len && is_space(l->data[l->pos])) {
+		l->pos += 1;
+	}
+	if (l->pos == l->len || l->data[l->pos] == '\n') {
+		l->pos += l->pos < l->len;
+		l->eol = true;
+		return NULL;
+	}
+
+	size_t start = l->pos;
+	while (l->pos < l->len && !is_space(l->data[l->pos]) &&
+			l->data[l->pos] != '\n') {
+		l->pos += 1;
+	}
+	l->column  = (int64_t)(start - l->line_start) + 1;
+	size_t end = l->pos;
+	if (l->pos == l->len) {
+		l->eol = true;
+	} else {
+		l->eol = l->data[l->pos] == '\n';
+		l->pos += 1;
+	}
+	// At the end of the file, this is the extra byte after it.
+	l->data[end] = '\0';
+	return l->data + start;
+}
+
+static CModfile
+syntax_error(CModfile result, Lexer* l, char* error)
+{
+	result.status = l->line;
+	result.column = l->column;
+	result.error  = error;
+	return result;
+}
+
+// push_tokens adds the rest of the tokens on the current line to flags.
+static void
+push_tokens(Arena* mem, Lexer* l, CFlags* flags)
+{
+	for (char* flag = lex_token(l); flag != NULL; flag = lex_token(l)) {
+		*slice_push(mem, flags) = flag;
 	}
+}
+
+CModfile
+modfile_parse_buffer(Arena* mem, char* data, size_t len)
+{
+	CModfile result = {};
+	Lexer    l      = {.data = data, .len = len, .eol = true};
 
 	CPlatformFlags* platform_flags = &result.platform_flags;
-	StrSlice        lines = str_split(&scratch, (char*)cmod.data, '\n');
-	strslice_remove_empty(&lines);
-	for (size_t i = 0; i < lines.len; i += 1) {
-		Arena tmp  = scratch;
-		char* line = (char*)lines.data[i];
-		// TODO: handle all types of whitespace.
-		StrSlice parts = str_split(&tmp, line, ' ');
-		strslice_remove_empty(&parts);
-		if (parts.len == 0) {
+	CPlatformFlags* profiles       = &result.profiles;
+	while (lex_line(&l)) {
+		char* directive = lex_token(&l);
+		if (directive == NULL) {
 			continue;
 		}
 
-		if (parts.len < 2) {
-			result.status = i + 1;
-			return result;
+		char* arg = lex_token(&l);
+		if (arg == NULL) {
+			return syntax_error(result, &l, "missing argument");
 		}
 
-		if (strcmp(parts.data[0], "module") == 0) {
-			if (parts.len != 2 || result.import_path != NULL) {
-				result.status = i + 1;
-				return result;
+		char** field = NULL;
+		if (strcmp(directive, "module") == 0) {
+			field = &result.import_path;
+		} else if (strcmp(directive, "version") == 0) {
+			field = &result.version;
+		}
+		if (field != NULL) {
+			if (*field != NULL) {
+				return syntax_error(result, &l,
+						"directive given twice");
+			}
+			*field = arg;
+			if (lex_token(&l) != NULL) {
+				return syntax_error(
+						result, &l, "unexpected argument");
 			}
-
-			result.import_path =
-					str_format(mem, "%s", parts.data[1]);
 			continue;
 		}
 
-		if (strcmp(parts.data[0], "version") == 0) {
-			if (parts.len != 2 || result.version != NULL) {
-				result.status = i + 1;
-				return result;
+		if (strcmp(directive, "os") == 0) {
+			// TODO: only a set amount of OSs should be recognized.
+			CFlags* flags = CPlatformFlags_get(
+					mem, &platform_flags, arg);
+			size_t len_before = flags->len;
+			push_tokens(mem, &l, flags);
+			if (flags->len == len_before) {
+				return syntax_error(
+						result, &l, "missing flags");
 			}
+			continue;
+		}
 
-			result.version = str_format(mem, "%s", parts.data[1]);
+		if (strcmp(directive, "profile") == 0) {
+			// A profile may be declared without any flags of its
+			// own.
+			push_tokens(mem, &l,
+					CPlatformFlags_get(mem, &profiles, arg));
 			continue;
 		}
 
-		if (strcmp(parts.data[0], "os") == 0) {
-			// TODO: only a set amount of OSs should be recognized.
-			if (parts.len < 3) {
-				result.status = i + 1;
-				return result;
-			}
+		// Point at the directive rather than its argument.
+		l.column = (int64_t)((size_t)(directive - data) - l.line_start) + 1;
+		return syntax_error(result, &l, "unknown directive");
+	}
 
-			CFlags* flags = CPlatformFlags_get(mem,
-					&platform_flags,
-					str_format(mem, "%s", parts.data[1]));
-			for (size_t j = 2; j < parts.len; j += 1) {
-				char* tmp_flag = str_format(
-						mem, "%s", parts.data[j]);
-				*slice_push(mem, flags) = tmp_flag;
-			}
+	return result;
+}
 
-			continue;
-		}
+CModfile
+modfile_parse(Arena* mem, char* path)
+{
+	CModfile result = {};
 
-		result.status = i + 1;
+	// The result points into the file's contents, so they're never
+	// unmapped, and go in mem if they're read instead.
+	Bytes cmod = file_map(mem, path);
+	if (!cmod.ok) {
+		result.status = -1;
 		return result;
 	}
 
-	return result;
-}
\ No newline at end of file
+	return modfile_parse_buffer(mem, (char*)cmod.data, cmod.len);
+}
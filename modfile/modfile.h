@@ -20,12 +20,25 @@ struct CPlatformFlags {
 	CFlags          value;
 };
 
-// CModfile is the result of parsing a c.mod file.
+// CPlatformFlags_get returns the flags for the platform k in map. If there
+// are none, they are created if arena isn't NULL, and NULL is returned
+// otherwise.
+CFlags* CPlatformFlags_get(Arena* arena, CPlatformFlags** map, char* k);
+
+// CModfile is the result of parsing a c.mod file. Its strings point into the
+// file's contents rather than being copied.
 typedef struct CModfile {
-	int64_t        status;
+	int64_t status;
+	// When status is a line, the column of the error on it and what went
+	// wrong.
+	int64_t        column;
+	char*          error;
 	char*          import_path;
 	char*          version;
 	CPlatformFlags platform_flags;
+	// The flags each profile declared with the 'profile' directive adds,
+	// indexed by the profile's name.
+	CPlatformFlags profiles;
 } CModfile;
 
 // modfile_parse parses the given path to a c.mod file.
@@ -33,6 +46,12 @@ typedef struct CModfile {
 // If status is 0, the parse succeeded.
 // If status is negative, some error occurred before parsing could be done.
 // Otherwise status is the line where an error occurred.
-CModfile modfile_parse(Arena* mem, Arena scratch, char* path);
+CModfile modfile_parse(Arena* mem, char* path);
+
+// modfile_parse_buffer parses the len bytes of a c.mod file at data, like
+// modfile_parse. The tokens are terminated in place, so data is modified, has
+// to stay alive as long as the result, and has to be followed by one more
+// writable byte.
+CModfile modfile_parse_buffer(Arena* mem, char* data, size_t len);
 
 #endif // C_MODFILE_H
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Runs two checkouts of ../simple with crun, sharing one cache. They have the
+# same import path, so the manifest crun checks to skip the build is shared
+# too, and it must never run one checkout's executable for the other. $CRUN
+# is the crun binary to test, which is built from this repository if it isn't
+# set.
+set -eu
+cd "$(dirname "$0")"
+cbuild="$(pwd)/../../cbuild.py"
+if [ -z "${CRUN:-}" ]; then
+	(cd ../.. && python3 "$cbuild" crun)
+	CRUN="$(pwd)/../../crun/crun"
+fi
+
+tmp="$(mktemp -d)"
+trap 'rm -rf "$tmp"' EXIT
+export XDG_CACHE_HOME="$tmp/cache"
+cp -r ../simple "$tmp/a"
+rm -rf "$tmp/a/.cache" "$tmp/a/simple"
+
+# check_run runs crun in the checkout $1, expecting it to print $2.
+check_run() {
+	out="$(cd "$1" && "$CRUN" 2>&1)"
+	if [ "$out" != "$2" ]; then
+		echo "$out" >&2
+		echo "error: unexpected output from crun in $1" >&2
+		exit 1
+	fi
+}
+
+# The first checkout is built by cbuild.py, and the second by crun, so both
+# implementations' manifests are checked.
+original="$(printf 'hi there\nme too')"
+changed="$(printf 'hi there\nme too\nme too')"
+(cd "$tmp/a" && python3 "$cbuild")
+check_run "$tmp/a" "$original"
+cp -r "$tmp/a" "$tmp/b"
+sed -i 's/coolio();/coolio();\n\tcoolio();/' "$tmp/b/main.c"
+check_run "$tmp/b" "$changed"
+check_run "$tmp/a" "$original"
+
+# Without its executable, a checkout must be built again.
+rm "$tmp/b/simple"
+check_run "$tmp/b" "$changed"
@@ -0,0 +1,64 @@
+#!/bin/sh
+# Builds ../simple with a remote cache, then again with an empty local cache,
+# which must fetch every output instead of compiling it, and the same from a
+# copy of the project in another directory. This is done with a directory as
+# the remote cache, and with tools/cache_server.py standing in for an HTTP
+# server. Finally, a corrupted entry must be ignored.
+set -eu
+cd "$(dirname "$0")"
+cbuild="$(pwd)/../../cbuild.py"
+
+tmp="$(mktemp -d)"
+server=
+trap '[ -z "$server" ] || kill "$server"; rm -rf "$tmp"' EXIT
+cp -r ../simple "$tmp/project"
+rm -rf "$tmp/project/.cache"
+cd "$tmp/project"
+
+# check_build builds the project with an empty local cache, checking the
+# summary --stats prints against $1.
+check_build() {
+	rm -rf .cache simple
+	out="$(python3 "$cbuild" --stats 2>&1)"
+	if ! echo "$out" | grep -q "^cache: $1\$"; then
+		echo "$out" >&2
+		echo "error: expected 'cache: $1'" >&2
+		exit 1
+	fi
+	./simple
+}
+
+export C_REMOTE_CACHE="$tmp/dir"
+check_build "0 hits (0 remote), 3 misses"
+check_build "3 hits (3 remote), 0 misses"
+
+# Nothing the compiler is given depends on where the project is, so another
+# checkout of it gets the same outputs.
+cp -r "$tmp/project" "$tmp/other"
+cd "$tmp/other"
+check_build "3 hits (3 remote), 0 misses"
+cd "$tmp/project"
+
+python3 "$(dirname "$cbuild")/tools/cache_server.py" --port 0 "$tmp/http" \
+	> "$tmp/port" &
+server=$!
+while [ ! -s "$tmp/port" ]; do sleep 0.1; done
+export C_REMOTE_CACHE="http://127.0.0.1:$(cat "$tmp/port")"
+check_build "0 hits (0 remote), 3 misses"
+check_build "3 hits (3 remote), 0 misses"
+
+# Entries can't make anything setuid or writable by others.
+for blob in $(find "$tmp/http/objects" -type f); do
+	sed -i 's/^output [0-7]* /output 7777 /' "$blob"
+done
+check_build "3 hits (3 remote), 0 misses"
+if [ -n "$(find .cache -perm /6022 -type f)" ]; then
+	echo "error: remote cache entry kept its setuid or write bits" >&2
+	exit 1
+fi
+
+# Flipping a byte in every stored output has to be caught by its checksum.
+for blob in $(find "$tmp/http/objects" -type f); do
+	printf 'X' | dd of="$blob" bs=1 seek=200 conv=notrunc 2>/dev/null
+done
+check_build "0 hits (0 remote), 3 misses"
@@ -0,0 +1,2 @@
+module python.eldidi.org/cbuild/tests/simple_lock
+version c11
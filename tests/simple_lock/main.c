@@ -0,0 +1,9 @@
+#include "example.invalid/greeting"
+#include "example.invalid/greeting/loud"
+
+int
+main()
+{
+	greeting("world");
+	loud_greeting("world");
+}
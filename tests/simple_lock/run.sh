@@ -0,0 +1,51 @@
+#!/bin/sh
+# Builds this project against a local git repository standing in for the
+# remote module example.invalid/greeting, whose sources are in
+# ../simple_lock_remote. The c.sum written here points the import at that
+# repository, so the build must never try to probe example.invalid.
+set -eu
+cd "$(dirname "$0")"
+
+remote="$(mktemp -d)"
+trap 'rm -rf "$remote"' EXIT
+cp -r ../simple_lock_remote "$remote/src"
+git -C "$remote/src" init -q -b main
+git -C "$remote/src" add .
+git -C "$remote/src" -c user.name=test -c user.email=test@example.invalid \
+	commit -q -m "initial commit"
+git clone -q --bare "$remote/src" "$remote/greeting.git"
+commit="$(git -C "$remote/src" rev-parse HEAD)"
+
+rm -rf .cache
+cat > c.sum <<SUM
+example.invalid/greeting example.invalid/greeting file://$remote/greeting.git $commit
+example.invalid/greeting/loud example.invalid/greeting file://$remote/greeting.git $commit
+SUM
+
+out="$(python3 ../../cbuild.py -v)"
+if echo "$out" | grep -q "^probing "; then
+	echo "error: build with a complete c.sum probed the network" >&2
+	exit 1
+fi
+./simple_lock
+
+# The second build mustn't touch git at all.
+out="$(python3 ../../cbuild.py -v)"
+if echo "$out" | grep -q "^git "; then
+	echo "error: build with everything downloaded ran git" >&2
+	exit 1
+fi
+./simple_lock
+
+# Without a c.sum, the imports have to be found by probing. Both come from the
+# same repository, so it must only be downloaded once.
+rm -rf .cache c.sum
+mkdir -p "$remote/repos/example.invalid"
+mv "$remote/greeting.git" "$remote/repos/example.invalid/greeting"
+out="$(C_REMOTE_URL="file://$remote/repos/" python3 ../../cbuild.py -v)"
+if [ "$(echo "$out" | grep -c "^downloading module ")" != 1 ]; then
+	echo "error: example.invalid/greeting wasn't downloaded exactly once" >&2
+	exit 1
+fi
+grep -q "^example.invalid/greeting/loud example.invalid/greeting " c.sum
+./simple_lock
@@ -0,0 +1,2 @@
+module example.invalid/greeting
+version c11
@@ -0,0 +1 @@
+void greeting(const char* name);
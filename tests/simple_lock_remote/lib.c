@@ -0,0 +1,7 @@
+#include <stdio.h>
+
+void
+greeting(const char* name)
+{
+	printf("hello, %s\n", name);
+}
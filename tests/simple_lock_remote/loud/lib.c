@@ -0,0 +1,7 @@
+#include <stdio.h>
+
+void
+loud_greeting(const char* name)
+{
+	printf("HELLO, %s!\n", name);
+}
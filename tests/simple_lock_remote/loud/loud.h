@@ -0,0 +1 @@
+void loud_greeting(const char* name);
@@ -0,0 +1,7 @@
+#include "python.eldidi.org/cbuild/tests/simple_multi/shared"
+
+int
+main()
+{
+	greet("a");
+}
@@ -0,0 +1,2 @@
+module python.eldidi.org/cbuild/tests/simple_multi
+version c11
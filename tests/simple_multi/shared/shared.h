@@ -0,0 +1 @@
+void greet(const char* name);
@@ -0,0 +1,208 @@
+#!/usr/bin/env python3
+# Benchmarks the build driver on a project generated by genproject.py.
+#
+# Each run measures three scenarios:
+#
+# - cold: a build with an empty cache, including downloading the remote
+#   modules.
+# - warm: a rebuild after one source file was changed.
+# - noop: a rebuild where nothing changed.
+#
+# For each, the wall time, the number of times the compiler was invoked and
+# the peak RSS of any process the build started (the driver included) are
+# recorded and written to a JSON file.
+import argparse
+import json
+import os
+import pathlib
+import platform
+import resource
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+import genproject
+
+REPO = pathlib.Path(__file__).resolve().parent.parent
+
+
+def measure(argv: list[str]):
+    """Runs argv and prints the peak RSS of it and its children as JSON.
+    bench.py runs each build through this in a fresh process, because the
+    RUSAGE_CHILDREN of a process covers every child it ever waited for."""
+    result = subprocess.run(argv, stdout=subprocess.DEVNULL)
+    usage = resource.getrusage(resource.RUSAGE_CHILDREN)
+    # ru_maxrss is in bytes on macOS, and kilobytes everywhere else.
+    peak = usage.ru_maxrss
+    if platform.system() == "Darwin":
+        peak //= 1024
+    print(json.dumps({"returncode": result.returncode, "peak_rss_kib": peak}))
+
+
+def write_wrapper(dir: pathlib.Path, compiler: str, counter: pathlib.Path) -> str:
+    """Writes a script to dir which counts its invocations in counter before
+    running compiler, returning its path."""
+    real = shutil.which(compiler)
+    if real is None:
+        print(f"error: compiler '{compiler}' not found", file=sys.stderr)
+        exit(1)
+
+    wrapper = dir / "cc"
+    wrapper.write_text(f'#!/bin/sh\necho >> "{counter}"\nexec "{real}" "$@"\n')
+    wrapper.chmod(0o755)
+    return str(wrapper)
+
+
+def run_build(
+    driver: list[str], project: pathlib.Path, env: dict, counter: pathlib.Path
+) -> dict:
+    counter.write_text("")
+    start = time.perf_counter()
+    result = subprocess.run(
+        [sys.executable, __file__, "--measure", "--"] + driver + ["./..."],
+        cwd=project,
+        env=env,
+        stdout=subprocess.PIPE,
+    )
+    wall = time.perf_counter() - start
+    measured = json.loads(result.stdout)
+    if result.returncode != 0 or measured["returncode"] != 0:
+        print("error: build failed", file=sys.stderr)
+        exit(1)
+
+    return {
+        "wall_s": wall,
+        "compiler_invocations": len(counter.read_text().splitlines()),
+        "peak_rss_kib": measured["peak_rss_kib"],
+    }
+
+
+def edit_one_file(project: pathlib.Path, run: int):
+    """Changes the contents of one source file in the deepest module, whose
+    change has to be seen by the most of the project."""
+    modules = sorted(
+        (dir for dir in project.glob("m*") if dir.is_dir()),
+        key=lambda dir: int(dir.name[1:]),
+    )
+    lib = modules[-1] / "lib.c"
+    with lib.open("a") as f:
+        f.write(f"// edited by bench.py, run {run}\n")
+
+
+def bench(args: argparse.Namespace):
+    work = pathlib.Path(tempfile.mkdtemp(prefix="cbuild-bench-"))
+    try:
+        args.out = work / "generated"
+        genproject.generate(args)
+        project = args.out / "project"
+        cache = project / ".cache"
+        counter = work / "count"
+
+        env = dict(os.environ)
+        env["CLANG_COMMAND"] = write_wrapper(work, args.compiler, counter)
+        env["C_REMOTE_URL"] = f"file://{(args.out / 'remotes').resolve()}/"
+        env["XDG_CACHE_HOME"] = str(cache)
+
+        if args.driver == "python":
+            driver = [sys.executable, str(REPO / "cbuild.py")]
+        else:
+            driver = [str(pathlib.Path(args.driver).resolve())]
+        driver.extend(args.driver_args)
+
+        results = []
+        for run in range(args.runs):
+            shutil.rmtree(cache, ignore_errors=True)
+            (project / "c.sum").unlink(missing_ok=True)
+            cold = run_build(driver, project, env, counter)
+            edit_one_file(project, run)
+            warm = run_build(driver, project, env, counter)
+            noop = run_build(driver, project, env, counter)
+            for scenario, result in [("cold", cold), ("warm", warm), ("noop", noop)]:
+                results.append({"scenario": scenario, "run": run, **result})
+                print(
+                    f"{scenario:>4} run {run}: {result['wall_s']:.3f}s, "
+                    + f"{result['compiler_invocations']} compiler invocations, "
+                    + f"{result['peak_rss_kib']} KiB peak RSS"
+                )
+
+        summary = {}
+        for scenario in ["cold", "warm", "noop"]:
+            runs = [r for r in results if r["scenario"] == scenario]
+            summary[scenario] = {
+                "median_wall_s": statistics.median(r["wall_s"] for r in runs),
+                "compiler_invocations": max(r["compiler_invocations"] for r in runs),
+                "max_peak_rss_kib": max(r["peak_rss_kib"] for r in runs),
+            }
+
+        output = {
+            "driver": args.driver,
+            "driver_args": args.driver_args,
+            "compiler": args.compiler,
+            "project": {
+                "modules": args.modules,
+                "files": args.files,
+                "fanout": args.fanout,
+                "depth": args.depth,
+                "remotes": args.remotes,
+                "seed": args.seed,
+            },
+            "summary": summary,
+            "results": results,
+        }
+        args.output.write_text(json.dumps(output, indent=1) + "\n")
+    finally:
+        if not args.keep:
+            shutil.rmtree(work)
+        else:
+            print(f"kept {work}")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) > 2 and sys.argv[1] == "--measure":
+        measure(sys.argv[3:])
+        exit(0)
+
+    argparser = argparse.ArgumentParser(
+        prog="bench",
+        description="benchmarks cold, warm and no-op builds of a generated "
+        + "project.",
+    )
+    argparser.add_argument(
+        "--driver",
+        default="python",
+        help="the driver to benchmark: 'python' for cbuild.py, or the path "
+        + "to a cbuild binary. Defaults to 'python'.",
+    )
+    argparser.add_argument(
+        "--driver-args",
+        metavar="ARGS",
+        type=str.split,
+        default=[],
+        help="extra arguments to pass to the driver, such as '-j 4'.",
+    )
+    argparser.add_argument(
+        "--compiler",
+        default=os.environ.get("CLANG_COMMAND", "clang"),
+        help="the compiler to build with. Defaults to $CLANG_COMMAND or clang.",
+    )
+    argparser.add_argument(
+        "--runs", metavar="N", type=int, default=3, help="defaults to 3."
+    )
+    argparser.add_argument(
+        "-o",
+        "--output",
+        metavar="FILE",
+        type=pathlib.Path,
+        default=pathlib.Path("bench.json"),
+        help="where to write the results. Defaults to bench.json.",
+    )
+    argparser.add_argument(
+        "--keep",
+        action="store_true",
+        help="keeps the generated project instead of deleting it.",
+    )
+    genproject.add_arguments(argparser)
+    bench(argparser.parse_args())
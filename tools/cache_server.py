@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+# A stand-in for a remote build cache server, for testing cbuild.py's HTTP
+# cache backend without one:
+#
+#	python3 tools/cache_server.py --port 8123 DIR &
+#	C_REMOTE_CACHE=http://127.0.0.1:8123 python3 cbuild.py
+#
+# A GET request for /NAME returns the file DIR/NAME, or 404 if there isn't
+# one, and a PUT request stores its body there. Once it's listening, the port
+# it listens on is printed, which is picked by the system with --port 0.
+import argparse
+import http.server
+import os
+import pathlib
+from typing import Optional
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    # Set before the server is started.
+    dir: pathlib.Path
+
+    def file(self) -> Optional[pathlib.Path]:
+        """Returns the file the request's path refers to, or None if it's
+        outside of dir."""
+        file = (self.dir / self.path.lstrip("/")).resolve()
+        if not file.is_relative_to(self.dir):
+            return None
+        return file
+
+    def do_GET(self):
+        file = self.file()
+        if file is None or not file.is_file():
+            self.send_error(404)
+            return
+
+        data = file.read_bytes()
+        self.send_response(200)
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def do_PUT(self):
+        file = self.file()
+        if file is None:
+            self.send_error(403)
+            return
+
+        data = self.rfile.read(int(self.headers["Content-Length"]))
+        file.parent.mkdir(parents=True, exist_ok=True)
+        tmp = file.with_name(f"{file.name}.{os.getpid()}.tmp")
+        tmp.write_bytes(data)
+        os.replace(tmp, file)
+        self.send_response(201)
+        self.send_header("Content-Length", "0")
+        self.end_headers()
+
+    def log_message(self, format, *args):
+        pass
+
+
+if __name__ == "__main__":
+    argparser = argparse.ArgumentParser(
+        prog="cache_server",
+        description="serves DIR as a remote build cache over HTTP.",
+    )
+    argparser.add_argument("dir", metavar="DIR", type=pathlib.Path)
+    argparser.add_argument(
+        "--port",
+        metavar="N",
+        type=int,
+        default=8123,
+        help="the port to listen on. Defaults to 8123.",
+    )
+    args = argparser.parse_args()
+    args.dir.mkdir(parents=True, exist_ok=True)
+    Handler.dir = args.dir.resolve()
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", args.port), Handler)
+    print(server.server_address[1], flush=True)
+    server.serve_forever()
@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+# Generates synthetic cbuild projects for benchmarking the build driver.
+#
+# The project's modules are arranged in layers: the root module's main.c
+# imports every module in the first layer, and each module imports up to
+# --fanout modules from the layer below it. Modules in the last layer import
+# the stand-in "remote" modules, which are generated as git repositories in
+# OUT/remotes so they can be fetched by pointing C_REMOTE_URL at
+# file://OUT/remotes/.
+import argparse
+import pathlib
+import random
+import shutil
+import subprocess
+
+PROJECT_IMPORT_PATH = "bench.invalid/project"
+REMOTE_DOMAIN = "bench.invalid"
+
+
+def module_source(name: str, index: int, imports: list[str], calls: list[str]) -> str:
+    """Returns the source of one of a module's files, which defines
+    <name>_<index>() and calls each function in calls."""
+    text = ""
+    for include in imports:
+        text += f'#include "{include}"\n'
+    text += "\n"
+    text += "int\n"
+    text += f"{name}_{index}(int x)\n"
+    text += "{\n"
+    text += f"\tint result = x * {index + 3} + {len(calls)};\n"
+    for call in calls:
+        text += f"\tresult += {call}(x + 1);\n"
+    text += "\treturn result;\n"
+    text += "}\n"
+    return text
+
+
+def write_module(
+    dir: pathlib.Path, name: str, files: int, imports: list[str], deps: list[str]
+):
+    """Writes a library module called name to dir with the given number of .c
+    files. Its first function calls the first function of each of deps, which
+    are the names of the modules at imports."""
+    dir.mkdir(parents=True, exist_ok=True)
+    header = ""
+    for i in range(files):
+        header += f"int {name}_{i}(int x);\n"
+    (dir / f"{name}.h").write_text(header)
+
+    lib = ""
+    for i in range(1, files):
+        lib += f'#include "./{name}_{i}.c"\n'
+    lib += module_source(name, 0, imports, [f"{dep}_0" for dep in deps])
+    (dir / "lib.c").write_text(lib)
+
+    for i in range(1, files):
+        # The rest of the files call the module's previous function, so
+        # every file's code is reachable from its first one.
+        (dir / f"{name}_{i}.c").write_text(
+            module_source(name, i, [], [f"{name}_{i - 1}"])
+        )
+
+
+def git(dir: pathlib.Path, *argv):
+    subprocess.run(
+        ["git", "-C", str(dir)] + list(argv),
+        check=True,
+        stdout=subprocess.DEVNULL,
+    )
+
+
+def write_remote(out: pathlib.Path, name: str, files: int):
+    """Writes a stand-in remote module to out / "remotes" as a git
+    repository."""
+    dir = out / "remotes" / REMOTE_DOMAIN / name
+    write_module(dir, name, files, [], [])
+    (dir / "c.mod").write_text(f"module {REMOTE_DOMAIN}/{name}\nversion c11\n")
+    git(dir, "init", "-q", "-b", "main")
+    git(dir, "add", ".")
+    git(
+        dir,
+        "-c",
+        "user.name=bench",
+        "-c",
+        "user.email=bench@bench.invalid",
+        "commit",
+        "-q",
+        "-m",
+        "generated",
+    )
+
+
+def generate(args: argparse.Namespace):
+    out: pathlib.Path = args.out
+    if out.exists():
+        shutil.rmtree(out)
+    project = out / "project"
+    project.mkdir(parents=True)
+    rng = random.Random(args.seed)
+
+    # Split the modules into layers as evenly as possible.
+    depth = max(1, min(args.depth, args.modules))
+    layers = [[] for _ in range(depth)]
+    for i in range(args.modules):
+        layers[i * depth // args.modules].append(f"m{i}")
+
+    remotes = [f"r{i}" for i in range(args.remotes)]
+    for name in remotes:
+        write_remote(out, name, args.files)
+
+    for level, layer in enumerate(layers):
+        for name in layer:
+            if level + 1 < len(layers):
+                below = layers[level + 1]
+                deps = rng.sample(below, min(args.fanout, len(below)))
+                imports = [f"{PROJECT_IMPORT_PATH}/{dep}" for dep in deps]
+            else:
+                deps = rng.sample(remotes, min(args.fanout, len(remotes)))
+                imports = [f"{REMOTE_DOMAIN}/{dep}" for dep in deps]
+            write_module(project / name, name, args.files, sorted(imports), deps)
+
+    main = ""
+    for name in layers[0]:
+        main += f'#include "{PROJECT_IMPORT_PATH}/{name}"\n'
+    main += "\n#include <stdio.h>\n\n"
+    main += "int\nmain()\n{\n\tint result = 0;\n"
+    for name in layers[0]:
+        main += f"\tresult += {name}_0(1);\n"
+    main += '\tprintf("%d\\n", result);\n'
+    main += "}\n"
+    (project / "main.c").write_text(main)
+    (project / "c.mod").write_text(
+        f"module {PROJECT_IMPORT_PATH}\nversion c11\n"
+    )
+
+
+def add_arguments(argparser: argparse.ArgumentParser):
+    """Adds the options describing the shape of the generated project."""
+    argparser.add_argument(
+        "--modules", metavar="N", type=int, default=16, help="defaults to 16."
+    )
+    argparser.add_argument(
+        "--files",
+        metavar="N",
+        type=int,
+        default=4,
+        help="the number of .c files in each module. Defaults to 4.",
+    )
+    argparser.add_argument(
+        "--fanout",
+        metavar="N",
+        type=int,
+        default=2,
+        help="the number of modules each module imports. Defaults to 2.",
+    )
+    argparser.add_argument(
+        "--depth",
+        metavar="N",
+        type=int,
+        default=4,
+        help="the number of layers the modules are split into. Defaults to 4.",
+    )
+    argparser.add_argument(
+        "--remotes",
+        metavar="N",
+        type=int,
+        default=2,
+        help="the number of stand-in remote modules. Defaults to 2.",
+    )
+    argparser.add_argument(
+        "--seed", type=int, default=0, help="seeds the choice of dependencies."
+    )
+
+
+if __name__ == "__main__":
+    argparser = argparse.ArgumentParser(
+        prog="genproject",
+        description="generates a synthetic cbuild project in OUT/project, with "
+        + "its remote modules in OUT/remotes.",
+    )
+    argparser.add_argument("out", metavar="OUT", type=pathlib.Path)
+    add_arguments(argparser)
+    generate(argparser.parse_args())
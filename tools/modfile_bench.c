@@ -0,0 +1,119 @@
+// Benchmarks modfile_parse_buffer, which the build driver runs on the c.mod of
+// every module in the graph on every build.
+//
+// usage: c tool modfile_bench [-n ITERATIONS] [FILE]
+//
+// Parses FILE, or a generated c.mod with a few hundred directives if none is
+// given, ITERATIONS times and prints the throughput.
+#include <inttypes.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "c.eldidi.org/c/modfile"
+#include "c.eldidi.org/c/util"
+#include "c.eldidi.org/x/arena"
+
+// generate returns a c.mod with lines directives, using every kind of
+// whitespace the parser accepts.
+static Bytes
+generate(Arena* mem, size_t lines)
+{
+	size_t cap  = 128 + lines * 96;
+	char*  data = arena_make(mem, char, cap);
+	int    len  = snprintf(data, cap, "module bench.invalid/project\n"
+					  "version c11\n");
+	for (size_t i = 0; i < lines; i += 1) {
+		char* format = i % 2 == 0
+		                       ? "os linux -DFLAG_%zu=1 -lm\t-pthread\n"
+		                       : "profile p%zu  -O2 -g\t-DNDEBUG\r\n";
+		len += snprintf(data + len, cap - (size_t)len, format, i);
+	}
+
+	return (Bytes){.ok = true, .data = (uint8_t*)data, .len = (size_t)len};
+}
+
+static double
+now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char** argv)
+{
+	VmArena memory = vm_arena_reserve(VM_ARENA_SIZE);
+	jmp_buf jb;
+	if (memory.base == NULL || setjmp(jb)) {
+		vm_arena_release(memory);
+		fprintf(stderr, "error: out of memory\n");
+		return EXIT_FAILURE;
+	}
+	Arena mem = vm_arena(memory, jb);
+
+	long  iterations = 100000;
+	char* path       = NULL;
+	for (int i = 1; i < argc; i += 1) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			iterations = strtol(argv[++i], NULL, 10);
+		} else if (argv[i][0] != '-' && path == NULL) {
+			path = argv[i];
+		} else {
+			fprintf(stderr, "usage: modfile_bench [-n ITERATIONS] "
+					"[FILE]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	Bytes input = {0};
+	if (path == NULL) {
+		input = generate(&mem, 256);
+	} else {
+		FILE* f = fopen(path, "rb");
+		if (f == NULL) {
+			fatal("couldn't open '%s'", path);
+		}
+		input = readfull(&mem, f);
+		fclose(f);
+		if (!input.ok) {
+			fatal("couldn't read '%s'", path);
+		}
+	}
+
+	// The parser terminates tokens in place, so each iteration gets a
+	// fresh copy. The copy is timed separately and left out.
+	char*  buf        = arena_make(&mem, char, input.len + 1);
+	char*  checkpoint = arena_checkpoint(&mem);
+	double parsing    = 0;
+	double copying    = 0;
+	for (long i = 0; i < iterations; i += 1) {
+		double start = now();
+		memcpy(buf, input.data, input.len);
+		double copied = now();
+
+		CModfile modfile = modfile_parse_buffer(&mem, buf, input.len);
+		if (modfile.status != 0) {
+			fatal("%s:%" PRId64 ":%" PRId64 ": %s",
+					path == NULL ? "<generated>" : path,
+					modfile.status, modfile.column,
+					modfile.error);
+		}
+		parsing += now() - copied;
+		copying += copied - start;
+		arena_rewind(&mem, checkpoint);
+	}
+
+	double bytes = (double)input.len * (double)iterations;
+	printf("%ld iterations of %zu bytes\n", iterations, input.len);
+	printf("parse: %.1f ns/iteration, %.1f MiB/s\n",
+			parsing / (double)iterations * 1e9,
+			bytes / parsing / (1 << 20));
+	printf("copy:  %.1f ns/iteration\n",
+			copying / (double)iterations * 1e9);
+	vm_arena_release(memory);
+	return EXIT_SUCCESS;
+}
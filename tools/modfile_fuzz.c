@@ -0,0 +1,241 @@
+// A fuzz harness for modfile_parse_buffer.
+//
+// Built with clang's -fsanitize=fuzzer -DC_LIBFUZZER, it's a libFuzzer target.
+// Otherwise, it runs each file given as an argument, or with no arguments a
+// few hundred thousand random inputs made from c.mod-like tokens:
+//
+//	c tool modfile_fuzz [FILE...]
+//
+// Besides not crashing, every successful parse has to have tokens without
+// whitespace in them, and has to give the same result when its formatted
+// output is parsed again.
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c.eldidi.org/c/modfile"
+#include "c.eldidi.org/c/util"
+#include "c.eldidi.org/x/arena"
+
+static VmArena memory;
+
+static void
+check_token(char* token)
+{
+	if (token == NULL) {
+		return;
+	}
+
+	assert(*token != '\0');
+	for (char* c = token; *c != '\0'; c += 1) {
+		assert(strchr(" \t\r\n\v\f", *c) == NULL);
+	}
+}
+
+// Format appends text to a buffer with room for everything the inputs can
+// format to.
+typedef struct Format {
+	char*  data;
+	size_t len;
+} Format;
+
+static void
+format_str(Format* f, char* s)
+{
+	size_t len = strlen(s);
+	memcpy(f->data + f->len, s, len);
+	f->len += len;
+}
+
+// format_flags formats each entry of the map current like cmod fmt, checking
+// its tokens.
+static void
+format_flags(Format* f, char* directive, CPlatformFlags* current)
+{
+	if (current->key != NULL) {
+		check_token(current->key);
+		format_str(f, directive);
+		format_str(f, " ");
+		format_str(f, current->key);
+		for (size_t i = 0; i < current->value.len; i += 1) {
+			check_token(current->value.data[i]);
+			format_str(f, " ");
+			format_str(f, current->value.data[i]);
+		}
+		format_str(f, "\n");
+	}
+
+	for (size_t i = 0; i < 4; i += 1) {
+		if (current->child[i] != NULL) {
+			format_flags(f, directive, current->child[i]);
+		}
+	}
+}
+
+static bool
+str_equal(char* a, char* b)
+{
+	return a == b || (a != NULL && b != NULL && strcmp(a, b) == 0);
+}
+
+// flags_subset returns whether every entry of the map current is in other,
+// with the same flags.
+static bool
+flags_subset(CPlatformFlags* current, CPlatformFlags* other)
+{
+	if (current->key != NULL) {
+		CFlags* flags = CPlatformFlags_get(NULL, &other, current->key);
+		if (flags == NULL || flags->len != current->value.len) {
+			return false;
+		}
+		for (size_t i = 0; i < flags->len; i += 1) {
+			if (!str_equal(flags->data[i], current->value.data[i])) {
+				return false;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < 4; i += 1) {
+		if (current->child[i] != NULL &&
+				!flags_subset(current->child[i], other)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool
+flags_equal(CPlatformFlags* a, CPlatformFlags* b)
+{
+	return flags_subset(a, b) && flags_subset(b, a);
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t* data, size_t len)
+{
+	jmp_buf jb;
+	if (memory.base == NULL) {
+		memory = vm_arena_reserve(VM_ARENA_SIZE);
+		assert(memory.base != NULL);
+	}
+	if (setjmp(jb)) {
+		panic("out of memory parsing %zu bytes", len);
+	}
+	Arena mem = vm_arena(memory, jb);
+
+	char* buf = arena_make(&mem, char, len + 1);
+	memcpy(buf, data, len);
+	CModfile first = modfile_parse_buffer(&mem, buf, len);
+	if (first.status != 0) {
+		assert(first.status > 0);
+		assert(first.column > 0);
+		assert(first.error != NULL);
+		return 0;
+	}
+
+	// Formatting never makes the input longer than twice its size.
+	Format f = {.data = arena_make(&mem, char, 2 * len + 64)};
+	check_token(first.import_path);
+	check_token(first.version);
+	if (first.import_path != NULL) {
+		format_str(&f, "module ");
+		format_str(&f, first.import_path);
+		format_str(&f, "\n");
+	}
+	if (first.version != NULL) {
+		format_str(&f, "version ");
+		format_str(&f, first.version);
+		format_str(&f, "\n");
+	}
+	format_flags(&f, "os", &first.platform_flags);
+	format_flags(&f, "profile", &first.profiles);
+
+	CModfile second = modfile_parse_buffer(&mem, f.data, f.len);
+	assert(second.status == 0);
+	assert(str_equal(first.import_path, second.import_path));
+	assert(str_equal(first.version, second.version));
+	assert(flags_equal(&first.platform_flags, &second.platform_flags));
+	assert(flags_equal(&first.profiles, &second.profiles));
+	return 0;
+}
+
+#ifndef C_LIBFUZZER
+static uint64_t
+next_random(uint64_t* state)
+{
+	// xorshift64
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+// random_input writes up to cap bytes of tokens c.mod files are made of,
+// separated by random whitespace, to buf, returning how many it wrote.
+static size_t
+random_input(uint64_t* state, uint8_t* buf, size_t cap)
+{
+	static char* tokens[] = {"module", "version", "os", "profile", "linux",
+			"c11", "a/b", "-O2", "-lm", "-Wl,--gc-sections", "\0",
+			"#", "x"};
+	static char* spaces[] = {" ", "  ", "\t", "\n", "\r\n", "\v", "\f",
+			"\n\n", ""};
+	size_t       len      = 0;
+	size_t       count    = next_random(state) % 32;
+	for (size_t i = 0; i < count; i += 1) {
+		char* token = tokens[next_random(state) %
+				(sizeof(tokens) / sizeof(char*))];
+		char* space = spaces[next_random(state) %
+				(sizeof(spaces) / sizeof(char*))];
+		// The NUL token is one byte long.
+		size_t token_len = *token == '\0' ? 1 : strlen(token);
+		size_t space_len = strlen(space);
+		if (len + token_len + space_len > cap) {
+			break;
+		}
+		memcpy(buf + len, token, token_len);
+		len += token_len;
+		memcpy(buf + len, space, space_len);
+		len += space_len;
+	}
+	return len;
+}
+
+int
+main(int argc, char** argv)
+{
+	if (argc > 1) {
+		for (int i = 1; i < argc; i += 1) {
+			VmArena file_memory = vm_arena_reserve(VM_ARENA_SIZE);
+			jmp_buf jb;
+			if (file_memory.base == NULL || setjmp(jb)) {
+				fatal("out of memory reading '%s'", argv[i]);
+			}
+			Arena mem = vm_arena(file_memory, jb);
+			FILE* f   = fopen(argv[i], "rb");
+			if (f == NULL) {
+				fatal("couldn't open '%s'", argv[i]);
+			}
+			Bytes input = readfull(&mem, f);
+			fclose(f);
+			if (!input.ok) {
+				fatal("couldn't read '%s'", argv[i]);
+			}
+			(void)LLVMFuzzerTestOneInput(input.data, input.len);
+			vm_arena_release(file_memory);
+		}
+		return EXIT_SUCCESS;
+	}
+
+	uint64_t state = 0x9e3779b97f4a7c15;
+	uint8_t  buf[1024];
+	for (long i = 0; i < 300000; i += 1) {
+		size_t len = random_input(&state, buf, sizeof(buf));
+		(void)LLVMFuzzerTestOneInput(buf, len);
+	}
+	printf("ok\n");
+	return EXIT_SUCCESS;
+}
+#endif
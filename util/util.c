@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <setjmp.h>
 #include <stdarg.h>
@@ -7,9 +8,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdnoreturn.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "c.eldidi.org/x/arena"
 #include "c.eldidi.org/x/backtrace"
+#include "c.eldidi.org/x/containers"
+#include "c.eldidi.org/x/fs"
+#include "c.eldidi.org/x/hash"
+#include "c.eldidi.org/x/str"
 
 // TODO: make this print the lines for each backtrace address if we can.
 noreturn void
@@ -67,34 +77,111 @@ todo(const char* format, ...)
 	exit(EXIT_FAILURE);
 }
 
-typedef struct FindInPathArg {
-	Arena* mem;
-	Arena  scratch;
-	char*  result;
-	char*  dir;
-	char*  target;
-} FindInPathArg;
+// fatal exits the program, printing an error message meant for the user.
+noreturn void
+fatal(const char* format, ...)
+{
+	fprintf(stderr, "error: ");
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
 
-bool
-find_in_path_fn(char* path, void* arg)
+// The arenas' allocator is bounds checked against the end of the Arena and
+// has no way to ask for more memory, so the whole range is mapped readable and
+// writable up front, and the kernel backs each page with memory the first time
+// it's touched. MAP_NORESERVE keeps the range from counting against the
+// system's commit limit, where that's honored.
+VmArena
+vm_arena_reserve(size_t size)
 {
-	assert(path != NULL);
-	FindInPathArg* result = arg;
-	char* file      = str_format(result->mem, "%s/%s", result->dir, path);
-	file            = fs_resolve(result->mem, result->scratch, file);
-	StatResult stat = fs_metadata(file);
-	if (stat.status != 0) {
-		return true;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	for (; size >= page; size /= 2) {
+		void* base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (base != MAP_FAILED) {
+			return (VmArena){.base = base, .size = size};
+		}
 	}
 
-	if (strcmp(path, result->target) != 0) {
-		return true;
+	return (VmArena){0};
+}
+
+Arena
+vm_arena(VmArena vm, void* jb)
+{
+	assert(vm.base != NULL);
+	return (Arena){
+			.beg     = vm.base,
+			.end     = vm.base + vm.size,
+			.jmp_buf = jb,
+	};
+}
+
+// Arenas hand out memory from the start of the range and zero everything they
+// hand out, so every page up to the last one used is resident, and nothing
+// after it is.
+size_t
+vm_arena_peak(VmArena vm)
+{
+	if (vm.base == NULL) {
+		return 0;
 	}
 
-	result->result = file;
-	return false;
+	size_t        page = (size_t)sysconf(_SC_PAGESIZE);
+	unsigned char resident[4096];
+	size_t        chunk = page * sizeof(resident);
+	size_t        peak  = 0;
+	for (size_t offset = 0; offset < vm.size; offset += chunk) {
+		size_t len = vm.size - offset < chunk ? vm.size - offset : chunk;
+		if (mincore(vm.base + offset, len, (void*)resident) != 0) {
+			return peak;
+		}
+
+		size_t pages = (len + page - 1) / page;
+		size_t used  = 0;
+		for (size_t i = 0; i < pages; i += 1) {
+			if (resident[i] & 1) {
+				used = i + 1;
+			}
+		}
+		if (used == 0) {
+			return peak;
+		}
+		peak = offset + used * page;
+	}
+
+	return peak;
+}
+
+void
+vm_arena_release(VmArena vm)
+{
+	if (vm.base != NULL) {
+		(void)munmap(vm.base, vm.size);
+	}
+}
+
+char*
+arena_checkpoint(Arena* a)
+{
+	assert(a != NULL);
+	return a->beg;
 }
 
+void
+arena_rewind(Arena* a, char* checkpoint)
+{
+	assert(a != NULL);
+	assert(checkpoint <= a->beg);
+	a->beg = checkpoint;
+}
+
+// Each directory in PATH is probed for the binary directly, which is a stat
+// per directory instead of one per file in it.
 char*
 find_in_path(Arena* mem, Arena scratch, char* binary_name)
 {
@@ -104,25 +191,337 @@ find_in_path(Arena* mem, Arena scratch, char* binary_name)
 		return NULL;
 	}
 
-	StrSlice paths = str_split(&scratch, PATH, ':');
-	for (size_t i = 0; i < paths.len; i += 1) {
-		Arena         tmp = scratch;
-		FindInPathArg fp  = {
-				 .dir     = paths.data[i],
-				 .mem     = &tmp,
-				 .scratch = tmp,
-				 .target  = binary_name,
-                };
-		(void)fs_foreach_file(paths.data[i], find_in_path_fn, &fp);
-		if (fp.result == NULL) {
-			continue;
+	for (char* dir = PATH;; dir += 1) {
+		Arena  tmp = scratch;
+		size_t len = strcspn(dir, ":");
+		// An empty entry stands for the current directory.
+		char* file = len == 0 ? str_format(&tmp, "./%s", binary_name)
+		                      : str_format(&tmp, "%.*s/%s", (int)len,
+						dir, binary_name);
+		struct stat st;
+		if (stat(file, &st) == 0 && S_ISREG(st.st_mode) &&
+				access(file, X_OK) == 0) {
+			return fs_resolve(mem, tmp, file);
+		}
+
+		dir += len;
+		if (*dir == '\0') {
+			return NULL;
+		}
+	}
+}
+
+char*
+command_find(Arena* mem, Arena scratch, char* name)
+{
+	assert(name != NULL);
+	char* C_ROOT = getenv("C_ROOT");
+	if (C_ROOT == NULL) {
+		C_ROOT = "/c";
+	}
+
+	char* file = str_format(&scratch, "%s/commands/c%s", C_ROOT, name);
+	struct stat st;
+	if (strchr(name, '/') != NULL || stat(file, &st) != 0 ||
+			!S_ISREG(st.st_mode) || access(file, X_OK) != 0) {
+		return NULL;
+	}
+	return str_format(mem, "%s", file);
+}
+
+char*
+c_cache_dir(Arena* mem)
+{
+	char* dir = getenv("XDG_CACHE_HOME");
+	return str_format(mem, "%s/c", dir == NULL ? ".cache" : dir);
+}
+
+bool
+has_suffix(char* s, char* suffix)
+{
+	size_t len        = strlen(s);
+	size_t suffix_len = strlen(suffix);
+	return len >= suffix_len &&
+	       strcmp(s + len - suffix_len, suffix) == 0;
+}
+
+bool
+is_dir(char* path)
+{
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+typedef struct ListDirArg {
+	Arena*    mem;
+	StrSlice* result;
+} ListDirArg;
+
+static bool
+list_dir_fn(char* file, void* arg)
+{
+	ListDirArg* ld = arg;
+	if (strcmp(file, ".") == 0 || strcmp(file, "..") == 0) {
+		return true;
+	}
+
+	*slice_push(ld->mem, ld->result) = str_format(ld->mem, "%s", file);
+	return true;
+}
+
+static int
+compare_names(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+StrSlice
+list_dir(Arena* mem, char* dir)
+{
+	StrSlice   result = {0};
+	ListDirArg ld     = {.mem = mem, .result = &result};
+	(void)fs_foreach_file(dir, list_dir_fn, &ld);
+	// qsort mustn't be passed NULL, even for an empty array.
+	if (result.len != 0) {
+		qsort(result.data, result.len, sizeof(char*), compare_names);
+	}
+	return result;
+}
+
+bool
+make_dirs(Arena scratch, char* path)
+{
+	char* p = str_format(&scratch, "%s", path);
+	for (char* c = p + 1; *c != '\0'; c += 1) {
+		if (*c == '/') {
+			*c = '\0';
+			(void)mkdir(p, 0755);
+			*c = '/';
+		}
+	}
+
+	return mkdir(p, 0755) == 0 || is_dir(p);
+}
+
+int64_t
+mtime(char* path)
+{
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return -1;
+	}
+
+#if defined(__APPLE__)
+	return (int64_t)st.st_mtimespec.tv_sec * 1000000000 +
+	       st.st_mtimespec.tv_nsec;
+#else
+	return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+}
+
+// command_output runs argv, returning the first line it wrote to stdout, or
+// NULL if it failed.
+static char*
+command_output(Arena* mem, char** argv)
+{
+	int fds[2];
+	if (pipe(fds) != 0) {
+		return NULL;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return NULL;
+	}
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(fds[1], STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		close(fds[0]);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	close(fds[1]);
+	Bytes output = {.ok = false};
+	FILE* f      = fdopen(fds[0], "rb");
+	if (f != NULL) {
+		output = readfull(mem, f);
+		fclose(f);
+	} else {
+		close(fds[0]);
+	}
+
+	int status = 0;
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+			WEXITSTATUS(status) != 0 || !output.ok) {
+		return NULL;
+	}
+
+	char* line                 = (char*)output.data;
+	line[strcspn(line, "\r\n")] = '\0';
+	return line;
+}
+
+// file_identity returns the inode and modification time of path, which change
+// whenever the file is replaced or modified, or NULL if it doesn't exist.
+static char*
+file_identity(Arena* mem, char* path)
+{
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return NULL;
+	}
+
+#if defined(__APPLE__)
+	int64_t sec  = (int64_t)st.st_mtimespec.tv_sec;
+	int64_t nsec = (int64_t)st.st_mtimespec.tv_nsec;
+#else
+	int64_t sec  = (int64_t)st.st_mtim.tv_sec;
+	int64_t nsec = (int64_t)st.st_mtim.tv_nsec;
+#endif
+	return str_format(mem, "%" PRIu64 " %" PRId64 ".%09" PRId64,
+			(uint64_t)st.st_ino, sec, nsec);
+}
+
+// toolchain_fingerprint hashes everything toolchain_find found out about a
+// compiler. cbuild.py keys its cache with the same fields.
+static char*
+toolchain_fingerprint(Arena* mem, Arena scratch, Toolchain* t)
+{
+	char* identity = str_format(&scratch, "%s\n%s\n%s\n%s", t->path,
+			t->version, t->target, t->resource_dir);
+	return str_format(mem, "%016" PRIx64, fnv_1a_str(identity));
+}
+
+// toolchain_read reads the toolchain cache file written by toolchain_find,
+// returning whether it describes the compiler at path in its current state.
+// Each line holds a key, a space and its value.
+static bool
+toolchain_read(Arena* mem, Arena scratch, char* file, char* key, char* path,
+		Toolchain* t)
+{
+	Bytes data = file_map(mem, file);
+	if (!data.ok) {
+		return false;
+	}
+
+	char* cached_key      = NULL;
+	char* cached_identity = NULL;
+	for (char* line = (char*)data.data; *line != '\0';) {
+		size_t len  = strcspn(line, "\n");
+		char*  next = line[len] == '\0' ? line + len : line + len + 1;
+		line[len]   = '\0';
+		char* value = line + strcspn(line, " ");
+		if (*value == ' ') {
+			*value++ = '\0';
+		}
+
+		if (strcmp(line, "key") == 0) {
+			cached_key = value;
+		} else if (strcmp(line, "identity") == 0) {
+			cached_identity = value;
+		} else if (strcmp(line, "path") == 0) {
+			t->path = value;
+		} else if (strcmp(line, "version") == 0) {
+			t->version = value;
+		} else if (strcmp(line, "target") == 0) {
+			t->target = value;
+		} else if (strcmp(line, "resource-dir") == 0) {
+			t->resource_dir = value;
 		}
+		line = next;
+	}
+	// The cache file's name is a hash of the key, and the key itself is
+	// escaped, so it's compared in that form.
+	char* escaped = str_format(&scratch, "%s", key);
+	for (char* c = escaped; *c != '\0'; c += 1) {
+		*c = *c == '\n' ? ' ' : *c;
+	}
+
+	if (cached_key == NULL || cached_identity == NULL || t->path == NULL ||
+			t->version == NULL || t->target == NULL ||
+			t->resource_dir == NULL ||
+			strcmp(cached_key, escaped) != 0 ||
+			strcmp(t->path, path) != 0) {
+		return false;
+	}
+	char* identity = file_identity(&scratch, t->path);
+	return identity != NULL && strcmp(identity, cached_identity) == 0;
+}
 
-		char* result = str_format(mem, "%s", fp.result);
+Toolchain
+toolchain_find(Arena* mem, Arena scratch, char* cache_dir, char* name)
+{
+	assert(cache_dir != NULL && name != NULL);
+	char* PATH = getenv("PATH");
+	char* key  = str_format(&scratch, "%s\n%s", PATH == NULL ? "" : PATH,
+			 name);
+	char* dir  = str_format(&scratch, "%s/toolchain", cache_dir);
+	char* file = str_format(
+			&scratch, "%s/%016" PRIx64, dir, fnv_1a_str(key));
+
+	// Looking the compiler up again is only a stat per directory in PATH,
+	// and catches one installed in front of the cached one.
+	Toolchain result = {0};
+	char*     path   = strchr(name, '/') != NULL
+	                           ? fs_resolve(mem, scratch, name)
+	                           : find_in_path(mem, scratch, name);
+	if (path == NULL) {
 		return result;
 	}
+	if (toolchain_read(mem, scratch, file, key, path, &result)) {
+		result.fingerprint = toolchain_fingerprint(mem, scratch, &result);
+		return result;
+	}
+
+	result      = (Toolchain){0};
+	result.path = path;
 
-	return NULL;
+	// Anything the compiler can't say is left empty rather than failing,
+	// since the compiler may still work.
+	char* version[]  = {result.path, "--version", NULL};
+	char* target[]   = {result.path, "-dumpmachine", NULL};
+	char* includes[] = {result.path, "-print-file-name=include", NULL};
+	result.version   = command_output(mem, version);
+	result.target    = command_output(mem, target);
+	// Both clang and gcc keep their own headers in an include directory
+	// next to their runtime libraries.
+	result.resource_dir = command_output(mem, includes);
+	if (result.resource_dir != NULL &&
+			strrchr(result.resource_dir, '/') != NULL) {
+		*strrchr(result.resource_dir, '/') = '\0';
+	}
+	result.version = result.version == NULL ? "" : result.version;
+	result.target  = result.target == NULL ? "" : result.target;
+	result.resource_dir =
+			result.resource_dir == NULL ? "" : result.resource_dir;
+	result.fingerprint = toolchain_fingerprint(mem, scratch, &result);
+
+	// Failing to cache the result only makes the next lookup slower.
+	char* identity = file_identity(&scratch, result.path);
+	if (identity == NULL || !make_dirs(scratch, dir)) {
+		return result;
+	}
+	char* tmp = str_format(&scratch, "%s.%d.tmp", file, (int)getpid());
+	FILE* f   = fopen(tmp, "wb");
+	if (f == NULL) {
+		return result;
+	}
+	for (char* c = key; *c != '\0'; c += 1) {
+		*c = *c == '\n' ? ' ' : *c;
+	}
+	fprintf(f,
+			"key %s\nidentity %s\npath %s\nversion %s\ntarget "
+			"%s\nresource-dir %s\n",
+			key, identity, result.path, result.version,
+			result.target, result.resource_dir);
+	if (fclose(f) != 0 || rename(tmp, file) != 0) {
+		(void)remove(tmp);
+	}
+	return result;
 }
 
 Bytes
@@ -131,34 +530,115 @@ readfull(Arena* mem, FILE* f)
 	assert(mem != NULL);
 	assert(f != NULL);
 	Bytes result = {.ok = false};
-	fseek(f, 0, SEEK_END);
-	size_t len = ftell(f);
-	fseek(f, 0, SEEK_SET);
-	uint8_t* tmp = arena_make(mem, uint8_t, len + 1);
-	result.data  = tmp;
-
-	if (fread(tmp, 1, len, f) != len) {
-		free(tmp);
+
+	// The size of a regular file is known up front, with a byte to spare so
+	// reaching its end doesn't look like it needs more room. Anything else,
+	// like a pipe, is read until it ends.
+	size_t      cap = 4096;
+	struct stat st;
+	if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode)) {
+		cap = (size_t)st.st_size + 1;
+	}
+
+	uint8_t* data = arena_make(mem, uint8_t, cap + 1);
+	size_t   len  = 0;
+	while (true) {
+		len += fread(data + len, 1, cap - len, f);
+		if (len < cap) {
+			break;
+		}
+
+		uint8_t* grown = arena_make(mem, uint8_t, 2 * cap + 1);
+		memcpy(grown, data, len);
+		data = grown;
+		cap *= 2;
+	}
+	if (ferror(f)) {
+		return result;
+	}
+
+	result.ok   = true;
+	result.data = data;
+	result.len  = len;
+	return result;
+}
+
+// file_map_size returns the size of the mapping for a file of len bytes,
+// which has room for the NUL byte after it.
+static size_t
+file_map_size(size_t len)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	return (len / page + 1) * page;
+}
+
+Bytes
+file_map(Arena* mem, char* path)
+{
+	assert(path != NULL);
+	Bytes result = {.ok = false};
+	int   fd     = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
 		return result;
 	}
 
-	result.ok  = true;
-	result.len = len;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return result;
+	}
+
+	if (S_ISREG(st.st_mode) && st.st_size >= FILE_MAP_MIN_SIZE) {
+		// The bytes after the end of a file in its last page read as
+		// zero, but when it ends on a page boundary there's no such
+		// byte, so the mapping goes over a zeroed page one larger.
+		size_t len  = (size_t)st.st_size;
+		size_t size = file_map_size(len);
+		char*  base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base != MAP_FAILED &&
+				mmap(base, len, PROT_READ | PROT_WRITE,
+						MAP_PRIVATE | MAP_FIXED, fd,
+						0) != MAP_FAILED) {
+			close(fd);
+			result.ok     = true;
+			result.data   = (uint8_t*)base;
+			result.len    = len;
+			result.mapped = true;
+			return result;
+		}
+		if (base != MAP_FAILED) {
+			(void)munmap(base, size);
+		}
+	}
+
+	FILE* f = fdopen(fd, "rb");
+	if (f == NULL) {
+		close(fd);
+		return result;
+	}
+	result = readfull(mem, f);
+	fclose(f);
 	return result;
 }
 
+void
+file_unmap(Bytes contents)
+{
+	if (contents.mapped) {
+		(void)munmap(contents.data, file_map_size(contents.len));
+	}
+}
+
 void
 strslice_remove_empty(StrSlice* s)
 {
 	assert(s != NULL);
-	for (size_t j = 0; j < s->len; j += 1) {
-		if (*s->data[j] != '\0') {
-			continue;
-		}
-
-		s->len -= 1;
-		for (size_t k = j; k < s->len; k += 1) {
-			s->data[k] = s->data[k + 1];
+	size_t len = 0;
+	for (size_t i = 0; i < s->len; i += 1) {
+		if (*s->data[i] != '\0') {
+			s->data[len++] = s->data[i];
 		}
 	}
+	s->len = len;
 }
@@ -15,19 +15,109 @@ noreturn void panic(const char* format, ...);
 // todo exits the program, printing a TODO message.
 noreturn void todo(const char* format, ...);
 
+// fatal exits the program, printing an error message meant for the user to
+// stderr. Unlike panic, it's for errors which aren't bugs.
+noreturn void fatal(const char* format, ...);
+
 #undef assert
 #define assert(...)                                                           \
 	((__VA_ARGS__) ? ((void)0)                                            \
 		       : panic("assertion failed: %s:%d: %s", __FILE__,       \
 					 __LINE__, #__VA_ARGS__))
 
+// VmArena is a large range of address space reserved up front, which an Arena
+// hands out memory from. Pages are only backed by memory once they're
+// touched, so a command can use as much memory as it needs without guessing
+// a size beforehand.
+typedef struct VmArena {
+	char*  base;
+	size_t size;
+} VmArena;
+
+// VM_ARENA_SIZE is how much address space the commands reserve for each of
+// their arenas.
+#define VM_ARENA_SIZE ((size_t)1 << (sizeof(void*) >= 8 ? 36 : 28))
+
+// vm_arena_reserve reserves up to size bytes of address space. If that much
+// can't be reserved, it tries smaller sizes before giving up and returning a
+// VmArena with a NULL base.
+VmArena vm_arena_reserve(size_t size);
+
+// vm_arena returns an Arena handing out vm's memory, which longjmps to jb once
+// it runs out.
+Arena vm_arena(VmArena vm, void* jb);
+
+// vm_arena_peak returns the number of bytes of vm which were ever handed out,
+// rounded up to whole pages.
+size_t vm_arena_peak(VmArena vm);
+
+// vm_arena_release gives vm's memory back to the system. Every Arena using it
+// becomes invalid.
+void vm_arena_release(VmArena vm);
+
+// arena_checkpoint returns a point to rewind a to with arena_rewind, which
+// frees everything allocated from it since, for scratch memory which outlives
+// a single copy of an Arena.
+char* arena_checkpoint(Arena* a);
+void  arena_rewind(Arena* a, char* checkpoint);
+
 // find_in_path looks for a binary in PATH, returning NULL if it wasn't found.
 char* find_in_path(Arena* mem, Arena scratch, char* binary_name);
 
+// command_find returns the path of the external command c<name> in
+// $C_ROOT/commands, or NULL if there's no such command.
+char* command_find(Arena* mem, Arena scratch, char* name);
+
+// has_suffix returns whether s ends with suffix.
+bool has_suffix(char* s, char* suffix);
+
+// is_dir returns whether path is a directory, following symlinks.
+bool is_dir(char* path);
+
+// list_dir returns the names of the files in dir other than '.' and '..',
+// sorted. It's empty if dir can't be read.
+StrSlice list_dir(Arena* mem, char* dir);
+
+// make_dirs creates path and its parents, returning whether it exists
+// afterwards.
+bool make_dirs(Arena scratch, char* path);
+
+// mtime returns the modification time of path in nanoseconds, or -1 if it
+// doesn't exist.
+int64_t mtime(char* path);
+
+// c_cache_dir returns the directory the commands keep their caches in.
+char* c_cache_dir(Arena* mem);
+
+// Toolchain describes a compiler found by toolchain_find.
+typedef struct Toolchain {
+	// The resolved path of the compiler, or NULL if it wasn't found.
+	char* path;
+	// The first line of its --version output, the target it compiles for,
+	// and the directory holding its own headers and runtime libraries.
+	// Empty if the compiler couldn't say.
+	char* version;
+	char* target;
+	char* resource_dir;
+	// A hash of all of the above, for build caches to key outputs by, so
+	// switching or upgrading compilers never reuses outputs from another.
+	char* fingerprint;
+} Toolchain;
+
+// toolchain_find finds the compiler called name, which is looked up in PATH
+// unless it contains a slash, and describes it. The result is kept in
+// cache_dir, keyed by PATH and name, for as long as PATH still leads to the
+// same binary and its inode and modification time stay the same, so finding
+// it again takes a few syscalls rather than running it.
+Toolchain toolchain_find(Arena* mem, Arena scratch, char* cache_dir, char* name);
+
 typedef struct Bytes {
 	bool     ok;
 	uint8_t* data;
 	size_t   len;
+	// Whether data was mapped by file_map, and has to be released with
+	// file_unmap.
+	bool mapped;
 } Bytes;
 
 // readfull reads the file f fully and returns a buffer containing its
@@ -35,6 +125,22 @@ typedef struct Bytes {
 // but will not be counted in the result's 'len' member.
 Bytes readfull(Arena* mem, FILE* f);
 
+// FILE_MAP_MIN_SIZE is the size below which file_map reads files instead of
+// mapping them. Mapping saves faulting in fresh arena pages to copy into, but
+// costs two mmap calls and a munmap, which is more than copying into pages a
+// reused scratch arena already has until files are a few hundred KiB.
+#define FILE_MAP_MIN_SIZE (64 * 1024)
+
+// file_map returns the contents of the file at path, followed by a NUL byte
+// which isn't counted in len, like readfull. Regular files are mapped into
+// memory, while small files, pipes and special files are read into mem. The
+// contents can be written to without changing the file, but the file mustn't
+// be truncated while it's mapped.
+Bytes file_map(Arena* mem, char* path);
+
+// file_unmap releases contents returned by file_map, if they were mapped.
+void file_unmap(Bytes contents);
+
 // strslice_remove_empty removes all empty strings from the given StrSlice.
 void strslice_remove_empty(StrSlice* parts);
 